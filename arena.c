@@ -0,0 +1,91 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+struct ArenaSlab {
+    ArenaSlab *next;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+static ArenaSlab *slab_new(Arena *A, size_t cap) {
+    ArenaSlab *s = xmalloc(sizeof(*s) + cap);
+    s->used = 0;
+    s->cap = cap;
+    A->nslabs++;
+    A->reserved += cap;
+    return s;
+}
+
+void arena_init(Arena *A, size_t slab_size) {
+    memset(A, 0, sizeof(*A));
+    A->slab_size = slab_size;
+}
+
+void arena_free(Arena *A) {
+    while (A->slabs) {
+        ArenaSlab *next = A->slabs->next;
+        free(A->slabs);
+        A->slabs = next;
+    }
+    arena_init(A, A->slab_size);
+}
+
+// Slabs are never reallocated, so returned memory stays put until
+// arena_free().
+char *arena_alloc(Arena *A, size_t n) {
+    ArenaSlab *s = A->slabs;
+    if (!s || s->cap - s->used < n) {
+        if (n > A->slab_size / 4) {
+            // big requests get a slab of their own behind the current one,
+            // so its free tail is not abandoned
+            ArenaSlab *big = slab_new(A, n);
+            big->used = n;
+            A->used += n;
+            if (s) {
+                big->next = s->next;
+                s->next = big;
+            } else {
+                big->next = NULL;
+                A->slabs = big;
+            }
+            return big->data;
+        }
+        s = slab_new(A, A->slab_size);
+        s->next = A->slabs;
+        A->slabs = s;
+    }
+    char *p = s->data + s->used;
+    s->used += n;
+    A->used += n;
+    return p;
+}
+
+char *arena_dup(Arena *A, const char *s, size_t n) {
+    char *p = arena_alloc(A, n);
+    if (n) memcpy(p, s, n);
+    return p;
+}
+
+// Make the n bytes at p, the most recent allocation, n + more bytes long:
+// in place when the current slab has room, otherwise as a copy.
+char *arena_grow(Arena *A, char *p, size_t n, size_t more) {
+    ArenaSlab *s = A->slabs;
+    if (s && p + n == s->data + s->used && s->cap - s->used >= more) {
+        s->used += more;
+        A->used += more;
+        return p;
+    }
+    char *q = arena_alloc(A, n + more);
+    memcpy(q, p, n);
+    arena_release(A, n);
+    return q;
+}
+
+void arena_release(Arena *A, size_t n) {
+    A->dead += n;
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaSlab ArenaSlab;
+
+// Bump allocator for line text. Memory is only returned when the whole
+// arena is freed; arena_release() just records that a caller stopped
+// using some bytes, so the statistics show how much of the arena is dead.
+typedef struct {
+    ArenaSlab *slabs; // current slab first
+    size_t slab_size;
+
+    size_t nslabs;
+    size_t reserved; // bytes in all slabs
+    size_t used;     // bytes handed out
+    size_t dead;     // bytes handed out and since released
+} Arena;
+
+void  arena_init(Arena *A, size_t slab_size);
+void  arena_free(Arena *A);
+char *arena_alloc(Arena *A, size_t n);
+char *arena_dup(Arena *A, const char *s, size_t n);
+char *arena_grow(Arena *A, char *p, size_t n, size_t more);
+void  arena_release(Arena *A, size_t n);
+
+#endif
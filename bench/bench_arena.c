@@ -0,0 +1,55 @@
+#define _POSIX_C_SOURCE 200809L
+#include "buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Load n short lines, apply random edits and report where the text of the
+// document lives: the original text, the arena or lines of their own.
+
+int main(int argc, char **argv) {
+    size_t n = argc >= 2 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t edits = argc >= 3 ? strtoul(argv[2], NULL, 10) : n / 2;
+    srand(1);
+
+    size_t len = 0;
+    char *text = malloc(n * 32 + 1);
+    for (size_t i = 0; i < n; i++) len += (size_t)sprintf(text + len, "line %zu of the text\n", i);
+
+    Buffer B;
+    buffer_init(&B);
+    buffer_load(&B, text, len, false);
+
+    for (size_t i = 0; i < edits; i++) {
+        size_t y = (size_t)rand() % buffer_nlines(&B);
+        size_t x = buffer_line(&B, y)->len;
+        x = x ? (size_t)rand() % x : 0;
+        switch (rand() % 8) {
+        case 0: buffer_insert_char(&B, y, x, 'x'); break;
+        case 1: case 2: buffer_split_line(&B, y, x); break;
+        case 3: case 4: buffer_join_lines(&B, y); break;
+        default: buffer_delete_char(&B, y, x); break;
+        }
+    }
+
+    size_t nviews = 0, narena = 0, nown = 0, own = 0;
+    for (size_t y = 0; y < buffer_nlines(&B); y++) {
+        const Line *ln = buffer_line(&B, y);
+        if (ln->cap) nown++, own += ln->cap;
+        else if (ln->data >= B.orig && ln->data < B.orig + B.orig_len) nviews++;
+        else narena++;
+    }
+
+    const Arena *A = &B.arena;
+    printf("%zu lines, %zu edits\n", n, edits);
+    printf("  original    %8zu lines  %10zu bytes\n", nviews, B.orig_len);
+    printf("  arena       %8zu lines  %10zu bytes in %zu slabs\n", narena, A->reserved, A->nslabs);
+    printf("    used      %10zu\n", A->used - A->dead);
+    printf("    dead      %10zu\n", A->dead);
+    printf("    unused    %10zu\n", A->reserved - A->used);
+    printf("  own buffer  %8zu lines  %10zu bytes\n", nown, own);
+
+    buffer_free(&B);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#define _POSIX_C_SOURCE 200809L
+#include "buffer.h"
+#include "grep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Search n lines of log-like text for a regular expression, building the
+// match list and counting only, then replace every match, and report the
+// throughput of each.
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc >= 2 ? strtoul(argv[1], NULL, 10) : 2000000;
+    const char *pat = argc >= 3 ? argv[2] : "ERROR .*timeout [0-9]+";
+    const char *with = argc >= 4 ? argv[3] : "FAILED";
+
+    size_t len = 0;
+    char *text = malloc(n * 64 + 1);
+    for (size_t i = 0; i < n; i++) {
+        const char *lvl = i % 97 == 0 ? "ERROR" : i % 7 == 0 ? "WARN" : "INFO";
+        len += (size_t)sprintf(text + len, "%08zu %s worker %zu: request timeout %zu ms\n", i, lvl, i % 13, i % 5000);
+    }
+
+    Buffer B;
+    buffer_init(&B);
+    buffer_load(&B, text, len, false);
+
+    double mb = (double)len / (1 << 20);
+    double t0 = now();
+    GrepMatch *m = NULL;
+    size_t found = grep_buffer(&B, pat, REG_EXTENDED, &m);
+    double t1 = now();
+    size_t counted = grep_buffer(&B, pat, REG_EXTENDED, NULL);
+    double t2 = now();
+
+    BufferEdit *e = malloc((found ? found : 1) * sizeof(BufferEdit));
+    for (size_t i = 0; i < found; i++) e[i] = (BufferEdit){ m[i].y, m[i].x, m[i].n, with, strlen(with) };
+    buffer_replace_spans(&B, e, found);
+    double t3 = now();
+
+    printf("%zu lines, %.0f MB, /%s/\n", n, mb, pat);
+    printf("  list   %8zu matches  %.3f s  %6.0f MB/s\n", found, t1 - t0, mb / (t1 - t0));
+    printf("  count  %8zu matches  %.3f s  %6.0f MB/s\n", counted, t2 - t1, mb / (t2 - t1));
+    printf("  replace %7zu matches  %.3f s\n", found, t3 - t2);
+
+    free(e);
+    free(m);
+    buffer_free(&B);
+    return 0;
+}
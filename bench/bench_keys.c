@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L
+#include "editor.h"
+
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "screen.h"
+#include "script.h"
+#include "util.h"
+
+// Replay a keystroke script against a document with the null screen
+// backend, so no terminal is needed. Every operation is timed: loading
+// the file, each key with the frame drawn after it (keys a prompt reads
+// belong to the key that opened it), and each wait for a save or a load
+// to finish. Reports latency percentiles per kind of operation, the rows
+// drawn, total time and peak RSS, each run in its own process. Ctrl+Q
+// ends a script. A run that crashes is reported and makes the exit
+// status 1.
+//
+//   bench_keys [-s ROWSxCOLS]                the standard scenarios
+//   bench_keys [-s ROWSxCOLS] SCRIPT FILE    replay SCRIPT against FILE
+//
+// Scripts are described in script.h; miedit --record SCRIPT records one.
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// One line of words and tabs, mb megabytes long.
+static void make_long_line(const char *path, size_t mb) {
+    FILE *f = fopen(path, "wb");
+    if (!f) die("fopen");
+    static const char *words[] = { "lorem ", "ipsum ", "dolor\t", "sit ", "amet, ", "consectetur " };
+    size_t total = mb << 20, written = 0;
+    for (size_t i = 0; written < total; i++) {
+        const char *w = words[i % 6];
+        if (fputs(w, f) == EOF) die("fputs");
+        written += strlen(w);
+    }
+    if (fputc('\n', f) == EOF || fclose(f) != 0) die("fclose");
+}
+
+// Log-like lines, mb megabytes of them; every 1000th is 2000 columns wide.
+static void make_log(const char *path, size_t mb) {
+    FILE *f = fopen(path, "wb");
+    if (!f) die("fopen");
+    size_t total = mb << 20, written = 0;
+    for (size_t i = 0; written < total; i++) {
+        int n = fprintf(f, "2024-01-01T00:00:%02zu.%06zu INFO worker-%zu request id=%zu done\n",
+                        i % 60, i % 1000000, i % 16, i);
+        if (n < 0) die("fprintf");
+        written += (size_t)n;
+        if (i % 1000 == 999) {
+            for (int k = 0; k < 200; k++) fputs("payload=x ", f);
+            fputc('\n', f);
+            written += 2001;
+        }
+    }
+    if (fclose(f) != 0) die("fclose");
+}
+
+static char *read_script(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) die(path);
+    size_t n = 0, cap = 4096;
+    char *text = xmalloc(cap);
+    for (size_t k; (k = fread(text + n, 1, cap - n, f)) > 0;) {
+        n += k;
+        if (n == cap) text = xrealloc(text, cap *= 2);
+    }
+    if (ferror(f)) die(path);
+    fclose(f);
+    *len = n;
+    return text;
+}
+
+static const struct {
+    const char *name;
+    const char *ext;
+    void (*make)(const char *path, size_t mb);
+    size_t mb;
+    const char *script;
+} scenarios[] = {
+    { "typing into the middle of a 4 MB line", ".txt", make_long_line, 4,
+      "Ctrl+G\n\"1:2000000\"\nEnter\n\"x\"*2000\nBackspace*500\n" },
+    { "typing into the middle of a 4 MB line, wrapped", ".txt", make_long_line, 4,
+      "Ctrl+W\nCtrl+G\n\"1:2000000\"\nEnter\n\"x\"*2000\nBackspace*500\n" },
+    { "typing into the middle of a 4 MB line, highlighted", ".log", make_long_line, 4,
+      "Ctrl+G\n\"1:2000000\"\nEnter\n\"x\"*2000\nBackspace*500\n" },
+    { "Enter storm at the top of 64 MB of lines", ".log", make_log, 64,
+      "Enter*5000\nBackspace*5000\n" },
+    { "paging through 64 MB of lines", ".log", make_log, 64,
+      "PageDown*3000\nCtrl+G\n\"50%\"\nEnter\nPageDown*3000\nPageUp*3000\n" },
+    { "paging through 64 MB of lines, wrapped", ".log", make_log, 64,
+      "Ctrl+W\nPageDown*3000\nCtrl+G\n\"50%\"\nEnter\nPageDown*3000\nPageUp*3000\n" },
+    { "saving 64 MB after edits", ".log", make_log, 64,
+      "\"x\"\nCtrl+S\nwait\nCtrl+G\n\"50%\"\nEnter\n\"y\"*10\nCtrl+S\nwait\n" },
+    { "loading 256 MB and going to the end", ".log", make_log, 256,
+      "Ctrl+G\n\"100%\"\nEnter\n" },
+};
+
+#define NSCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+// Times of one kind of operation.
+typedef struct {
+    char name[24];
+    double *t;
+    size_t n, cap;
+    size_t rows; // text rows drawn
+} OpStats;
+
+typedef struct {
+    OpStats *op;
+    size_t n, cap;
+} Report;
+
+static void report_add(Report *R, const char *name, double t, size_t rows) {
+    OpStats *s = NULL;
+    for (size_t i = 0; i < R->n && !s; i++) {
+        if (strcmp(R->op[i].name, name) == 0) s = &R->op[i];
+    }
+    if (!s) {
+        if (R->n == R->cap) {
+            R->cap = R->cap ? R->cap * 2 : 16;
+            R->op = xrealloc(R->op, R->cap * sizeof(OpStats));
+        }
+        s = &R->op[R->n++];
+        memset(s, 0, sizeof(*s));
+        snprintf(s->name, sizeof(s->name), "%s", name);
+    }
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->t = xrealloc(s->t, s->cap * sizeof(double));
+    }
+    s->t[s->n++] = t;
+    s->rows += rows;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest rank.
+static double percentile(const double *t, size_t n, double q) {
+    size_t k = (size_t)(q * (double)n + 0.999999);
+    return t[k ? k - 1 : 0];
+}
+
+static void report_print(Report *R, double wall) {
+    printf("  %-12s %7s %10s %9s %9s %9s %9s %8s\n", "op", "count", "total ms", "p50 us", "p90 us",
+           "p99 us", "max us", "rows/op");
+    double total = 0;
+    for (size_t i = 0; i < R->n; i++) {
+        OpStats *s = &R->op[i];
+        qsort(s->t, s->n, sizeof(double), cmp_double);
+        double sum = 0;
+        for (size_t k = 0; k < s->n; k++) sum += s->t[k];
+        total += sum;
+        printf("  %-12s %7zu %10.1f %9.0f %9.0f %9.0f %9.0f %8.1f\n", s->name, s->n, sum * 1e3,
+               percentile(s->t, s->n, 0.50) * 1e6, percentile(s->t, s->n, 0.90) * 1e6,
+               percentile(s->t, s->n, 0.99) * 1e6, s->t[s->n - 1] * 1e6, (double)s->rows / (double)s->n);
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("  total %.1f ms in operations, %.1f ms wall, peak RSS %ld MB\n", total * 1e3, wall * 1e3,
+           ru.ru_maxrss / 1024);
+}
+
+// Let loading and saving run to the end, as the main loop does between
+// keys.
+static void settle(Editor *E) {
+    for (;;) {
+        editor_poll(E);
+        editor_refresh_screen(E);
+        if (!buffer_loading(&E->buf) && !E->saving) return;
+        nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+}
+
+static void replay(Script *S, const char *path) {
+    Report R = { 0 };
+    double t0 = now();
+
+    Editor E;
+    double t = now();
+    editor_init(&E, path);
+    settle(&E);
+    report_add(&R, "load", now() - t, E.rows_drawn);
+
+    // keys go to the null backend a stretch between waits at a time
+    size_t at = 0, pastes = 0;
+    bool quit = false;
+    while (at < S->n && !quit) {
+        size_t end = at;
+        while (end < S->n && S->key[end] != SCRIPT_WAIT) end++;
+        if (S->npaste) screen_null_keys(S->key + at, end - at, S->paste + pastes, S->paste_len + pastes);
+        else screen_null_keys(S->key + at, end - at, NULL, NULL);
+        for (size_t i = at; i < end; i++) pastes += S->key[i] == SCREEN_PASTE;
+
+        int c;
+        while (!quit && (c = screen_getch(0)) != ERR) {
+            if (c == 17) { // Ctrl+Q
+                quit = true;
+                break;
+            }
+            char buf[16];
+            const char *name = script_key_name(c, buf, sizeof(buf));
+            if (c >= 0x20 && c < 0x100 && c != 0x7f) name = "typing";
+            else if (c == SCREEN_PASTE) name = "paste";
+            size_t rows = E.rows_drawn;
+            t = now();
+            editor_process_key(&E, c);
+            editor_poll(&E);
+            editor_refresh_screen(&E);
+            report_add(&R, name, now() - t, E.rows_drawn - rows);
+        }
+        if (!quit && end < S->n) {
+            size_t rows = E.rows_drawn;
+            t = now();
+            settle(&E);
+            report_add(&R, "wait", now() - t, E.rows_drawn - rows);
+            end++;
+        }
+        at = end;
+    }
+
+    report_print(&R, now() - t0);
+    editor_free(&E);
+    for (size_t i = 0; i < R.n; i++) free(R.op[i].t);
+    free(R.op);
+}
+
+// Each run in its own process, for its own peak RSS. Returns false, having
+// said why, if the run did not finish.
+static bool run(Script *S, const char *path) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) die("fork");
+    if (pid == 0) {
+        replay(S, path);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) die("waitpid");
+    if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        fprintf(stderr, "  FAILED: killed by signal %d (%s)\n", sig, strsignal(sig));
+        return false;
+    }
+    if (WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "  FAILED: exit status %d\n", WEXITSTATUS(status));
+        return false;
+    }
+    return true;
+}
+
+static void parse(Script *S, const char *name, const char *text, size_t len) {
+    size_t line = script_parse(S, text, len);
+    if (line) {
+        fprintf(stderr, "%s:%zu: not a key, \"text\", paste \"text\" or wait\n", name, line);
+        exit(2);
+    }
+}
+
+int main(int argc, char **argv) {
+    int rows = 24, cols = 80;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+        if (sscanf(argv[i + 1], "%dx%d", &rows, &cols) != 2 || rows < 3 || cols < 1) {
+            fprintf(stderr, "bench_keys: -s wants ROWSxCOLS\n");
+            return 2;
+        }
+        i += 2;
+    }
+    screen_null_size(rows, cols);
+    screen_init(SCREEN_NULL);
+
+    if (argc - i == 2) {
+        size_t len;
+        char *text = read_script(argv[i], &len);
+        Script S;
+        script_init(&S);
+        parse(&S, argv[i], text, len);
+        printf("%s on %s, %dx%d\n", argv[i], argv[i + 1], rows, cols);
+        bool ok = run(&S, argv[i + 1]);
+        script_free(&S);
+        free(text);
+        return ok ? 0 : 1;
+    }
+    if (argc != i) {
+        fprintf(stderr, "usage: %s [-s ROWSxCOLS] [SCRIPT FILE]\n", argv[0]);
+        return 2;
+    }
+
+    int failed = 0;
+    for (size_t k = 0; k < NSCENARIOS; k++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/miedit-bench-keys%s", scenarios[k].ext);
+        scenarios[k].make(path, scenarios[k].mb);
+        Script S;
+        script_init(&S);
+        parse(&S, scenarios[k].name, scenarios[k].script, strlen(scenarios[k].script));
+        printf("%s, %dx%d\n", scenarios[k].name, rows, cols);
+        if (!run(&S, path)) failed++;
+        script_free(&S);
+        unlink(path);
+    }
+    if (failed) fprintf(stderr, "bench_keys: %d of %zu scenarios failed\n", failed, NSCENARIOS);
+    return failed ? 1 : 0;
+}
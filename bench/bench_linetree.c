@@ -0,0 +1,51 @@
+#define _POSIX_C_SOURCE 200809L
+#include "buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Insert lines at random positions, then look them up and delete them
+// again, all at random positions.
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc >= 2 ? strtoul(argv[1], NULL, 10) : 100000;
+    srand(1);
+
+    Buffer B;
+    buffer_init(&B);
+
+    double t0 = now();
+    for (size_t i = 0; i < n; i++) {
+        char s[32];
+        int len = snprintf(s, sizeof(s), "line %zu", i);
+        buffer_insert_line(&B, (size_t)rand() % (buffer_nlines(&B) + 1), line_new_from(s, (size_t)len));
+    }
+    double t1 = now();
+
+    size_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += buffer_line(&B, (size_t)rand() % buffer_nlines(&B))->len;
+    double t2 = now();
+
+    for (size_t i = 0; i < n; i++) sum += buffer_line_at_offset(&B, (size_t)rand() % buffer_bytes(&B));
+    double t3 = now();
+
+    for (size_t i = 0; i < n; i++) buffer_delete_line(&B, (size_t)rand() % buffer_nlines(&B));
+    double t4 = now();
+
+    printf("%zu lines, random positions (ns/op)\n", n);
+    printf("  insert      %8.1f\n", (t1 - t0) * 1e9 / (double)n);
+    printf("  lookup      %8.1f\n", (t2 - t1) * 1e9 / (double)n);
+    printf("  offset->ln  %8.1f\n", (t3 - t2) * 1e9 / (double)n);
+    printf("  delete      %8.1f\n", (t4 - t3) * 1e9 / (double)n);
+    printf("  (checksum %zu)\n", sum);
+
+    buffer_free(&B);
+    return 0;
+}
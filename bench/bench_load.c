@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200809L
+#include "editor_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Load a file through the mmap path and the read() path, each in its own
+// process, and report the time until the first screen can be drawn, the
+// time until the whole file is indexed, peak RSS and anonymous (heap) RSS. Mapped
+// file pages count towards RSS but can be dropped by the kernel at any
+// time; anonymous memory cannot.
+//
+//   bench_load FILE      load an existing file
+//   bench_load -g MB     generate an MB-sized file of log-like lines first
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void generate(const char *path, size_t mb) {
+    FILE *f = fopen(path, "wb");
+    if (!f) die("fopen");
+    size_t total = mb << 20, written = 0;
+    for (size_t i = 0; written < total; i++) {
+        int n = fprintf(f, "2024-01-01T00:00:%02zu.%06zu INFO worker-%zu request id=%zu done\n",
+                        i % 60, i % 1000000, i % 16, i);
+        if (n < 0) die("fprintf");
+        written += (size_t)n;
+    }
+    if (fclose(f) != 0) die("fclose");
+}
+
+// Resident anonymous memory in MB, from /proc (Linux only; -1 elsewhere).
+static long rss_anon_mb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "RssAnon: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb < 0 ? -1 : kb / 1024;
+}
+
+static void run(const char *path, bool no_mmap) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) die("fork");
+    if (pid == 0) {
+        Editor E;
+        editor_init(&E, NULL);
+        E.no_mmap = no_mmap;
+        double t0 = now();
+        editor_load_file(&E, path);
+        double t1 = now();
+        while (editor_poll(&E) >= 0) nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+        double t2 = now();
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        printf("  %-5s first %7.3f s  all %7.3f s  %10zu lines  peak RSS %6ld MB  anon %6ld MB\n",
+               no_mmap ? "read" : "mmap", t1 - t0, t2 - t0, buffer_nlines(&E.buf),
+               ru.ru_maxrss / 1024, rss_anon_mb());
+        fflush(stdout);
+        _exit(0);
+    }
+    if (waitpid(pid, NULL, 0) < 0) die("waitpid");
+}
+
+int main(int argc, char **argv) {
+    const char *path = "/tmp/miedit-bench-load.txt";
+    size_t mb = 1024;
+    bool gen = true;
+    if (argc >= 3 && strcmp(argv[1], "-g") == 0) {
+        mb = strtoul(argv[2], NULL, 10);
+    } else if (argc >= 2) {
+        path = argv[1];
+        gen = false;
+    }
+    if (gen) generate(path, mb);
+
+    printf("%s\n", path);
+    run(path, true);
+    run(path, false);
+
+    if (gen) unlink(path);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L
+#include "save.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Load a file of log-like lines through a mapping, edit a few lines, then
+// 1% of them, and save after each round three ways: the old per-line
+// stdio loop, save_buffer() from memory only, and save_buffer() copying
+// unchanged runs from the source file.
+//
+//   bench_save [MB] [PATH]    default: 256 MB to bench_save.out
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void generate(const char *path, size_t mb) {
+    FILE *f = fopen(path, "wb");
+    if (!f) die("fopen");
+    size_t total = mb << 20, written = 0;
+    for (size_t i = 0; written < total; i++) {
+        int n = fprintf(f, "2024-01-01T00:00:%02zu.%06zu INFO worker-%zu request id=%zu done\n",
+                        i % 60, i % 1000000, i % 16, i);
+        if (n < 0) die("fprintf");
+        written += (size_t)n;
+    }
+    if (fclose(f) != 0) die("fclose");
+}
+
+// One fwrite per line and one fputc per newline.
+static int save_stdio(Buffer *B, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    for (size_t i = 0; i < buffer_nlines(B); i++) {
+        const Line *ln = buffer_line(B, i);
+        for (size_t x = 0, n; x < ln->len; x += n) {
+            const char *p = line_peek(ln, x, &n);
+            if (fwrite(p, 1, n, f) != n) return -1;
+        }
+        if (fputc('\n', f) == EOF) return -1;
+    }
+    return fclose(f);
+}
+
+static void edit(Buffer *B, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        size_t y = (size_t)rand() % buffer_nlines(B);
+        if (rand() % 2) buffer_insert_char(B, y, 0, '#');
+        else buffer_delete_char(B, y, 0);
+    }
+}
+
+static void report(const char *what, size_t bytes, double t) {
+    printf("  %-16s %8.3f s  %8.1f MB/s\n", what, t, (double)bytes / (1 << 20) / t);
+}
+
+static void round_trip(Buffer *B, const char *path) {
+    size_t bytes = buffer_bytes(B);
+    int src = B->orig_fd;
+
+    double t0 = now();
+    if (save_stdio(B, path) != 0) die("save_stdio");
+    double t1 = now();
+    B->orig_fd = -1;
+    if (save_buffer(B, path, false) != 0) die("save_buffer");
+    B->orig_fd = src;
+    double t2 = now();
+    if (save_buffer(B, path, false) != 0) die("save_buffer");
+    double t3 = now();
+    if (save_buffer(B, path, true) != 0) die("save_buffer");
+    double t4 = now();
+    report("stdio", bytes, t1 - t0);
+    report("writev", bytes, t2 - t1);
+    report("copy_file_range", bytes, t3 - t2);
+    report("  +fsync", bytes, t4 - t3);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc >= 2 ? strtoul(argv[1], NULL, 10) : 256;
+    const char *path = argc >= 3 ? argv[2] : "bench_save.out";
+
+    size_t srcsz = strlen(path) + 8;
+    char *src = xmalloc(srcsz);
+    snprintf(src, srcsz, "%s.src", path);
+    generate(src, mb);
+
+    int fd = open(src, O_RDONLY);
+    if (fd < 0) die("open");
+    size_t len = (size_t)lseek(fd, 0, SEEK_END);
+    char *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) die("mmap");
+
+    Buffer B;
+    buffer_init(&B);
+    buffer_load(&B, p, len, true);
+    buffer_set_source(&B, fd);
+    close(fd);
+    srand(1);
+
+    edit(&B, 3);
+    printf("%zu lines, %zu bytes, 3 lines edited\n", buffer_nlines(&B), buffer_bytes(&B));
+    round_trip(&B, path);
+
+    edit(&B, buffer_nlines(&B) / 100);
+    printf("1%% of lines edited\n");
+    round_trip(&B, path);
+
+    unlink(path);
+    unlink(src);
+    free(src);
+    buffer_free(&B);
+    return 0;
+}
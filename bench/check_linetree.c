@@ -0,0 +1,193 @@
+#include "linetree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// Drive the line tree through random edits, long runs of appends trimmed
+// from the end, bulk builds of sizes around powers of the node size, and
+// concatenation, checking its invariants (linetree_check()) and its lines
+// against a plain array after every step or few. Exits 1 at the first failure.
+//
+//   check_linetree [SEED]
+
+typedef struct {
+    size_t *id; // the line expected at each position, by the number it holds
+    size_t  n, cap;
+    size_t  next;
+} Model;
+
+static const char *what;
+static size_t step;
+
+static Line make_line(Model *M, size_t *id) {
+    char s[32];
+    *id = M->next++;
+    int len = snprintf(s, sizeof(s), "%zu", *id);
+    return line_new_from(s, (size_t)len);
+}
+
+static size_t line_id(Line *ln) {
+    char s[32];
+    size_t n = ln->len < sizeof(s) - 1 ? ln->len : sizeof(s) - 1;
+    memcpy(s, line_data(ln), n);
+    s[n] = '\0';
+    return strtoul(s, NULL, 10);
+}
+
+static void fail(const char *why, size_t at) {
+    fprintf(stderr, "check_linetree: %s, step %zu: %s (line %zu)\n", what, step, why, at);
+    exit(1);
+}
+
+static void model_insert(Model *M, size_t at, size_t id) {
+    if (M->n == M->cap) {
+        M->cap = M->cap ? M->cap * 2 : 1024;
+        M->id = xrealloc(M->id, M->cap * sizeof(size_t));
+    }
+    memmove(&M->id[at + 1], &M->id[at], (M->n - at) * sizeof(size_t));
+    M->id[at] = id;
+    M->n++;
+}
+
+static void model_remove(Model *M, size_t at) {
+    M->n--;
+    memmove(&M->id[at], &M->id[at + 1], (M->n - at) * sizeof(size_t));
+}
+
+static void insert(LineTree *T, Model *M, size_t at) {
+    size_t id;
+    linetree_insert(T, at, make_line(M, &id));
+    model_insert(M, at, id);
+}
+
+static void remove_at(LineTree *T, Model *M, size_t at) {
+    Line ln = linetree_remove(T, at);
+    if (line_id(&ln) != M->id[at]) fail("removed the wrong line", at);
+    line_free(&ln);
+    model_remove(M, at);
+}
+
+// The invariants, then up to WINDOW lines from a random start, which half
+// the time is close enough to the end to run past it.
+#define WINDOW 2048
+
+static void check(LineTree *T, const Model *M) {
+    step++;
+    const char *why = linetree_check(T);
+    if (why) fail(why, 0);
+    if (T->nlines != M->n) fail("wrong number of lines", T->nlines);
+    size_t from = M->n ? (size_t)rand() % M->n : 0;
+    if (M->n > WINDOW && rand() % 2) from = M->n - 1 - (size_t)rand() % WINDOW;
+    size_t to = M->n - from > WINDOW ? from + WINDOW : M->n;
+    LtIter it;
+    linetree_iter_begin(T, from, &it);
+    for (size_t y = from; y < to; y++) {
+        Line *ln = linetree_iter_next(&it);
+        if (!ln) fail("iteration ended early", y);
+        if (line_id(ln) != M->id[y]) fail("iteration returned the wrong line", y);
+    }
+    if (to == M->n && linetree_iter_next(&it)) fail("iteration went past the last line", M->n);
+    if (M->n) {
+        size_t y = (size_t)rand() % M->n;
+        if (line_id(linetree_get(T, y)) != M->id[y]) fail("lookup returned the wrong line", y);
+    }
+}
+
+static void reset(LineTree *T, Model *M, const char *name) {
+    linetree_free(T);
+    linetree_init(T);
+    M->n = 0;
+    what = name;
+    step = 0;
+}
+
+static void build(LineTree *T, Model *M, size_t n) {
+    linetree_free(T);
+    LtBuilder b;
+    linetree_build_begin(&b);
+    M->n = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t id;
+        linetree_build_add(&b, make_line(M, &id));
+        model_insert(M, M->n, id);
+    }
+    linetree_build_end(&b, T);
+}
+
+int main(int argc, char **argv) {
+    srand(argc >= 2 ? (unsigned)strtoul(argv[1], NULL, 10) : 1);
+    LineTree T, U;
+    Model M = { 0 }, N = { 0 };
+    linetree_init(&T);
+    linetree_init(&U);
+
+    reset(&T, &M, "random edits");
+    for (int i = 0; i < 40000; i++) {
+        if (M.n && rand() % 100 < 45) remove_at(&T, &M, (size_t)rand() % M.n);
+        else insert(&T, &M, (size_t)rand() % (M.n + 1));
+        if (i % 16 == 0) check(&T, &M);
+    }
+    check(&T, &M);
+
+    // Appends split without moving anything, leaving a node with one entry
+    // on the right edge at each level that just split. At one line past a
+    // multiple of 64 * 64 that includes a node above the leaves, and
+    // deleting the last line then empties its only child.
+    for (int round = 0; round < 8; round++) {
+        reset(&T, &M, "appends trimmed from the end");
+        size_t n = 4096 * (size_t)(1 + round % 4) + 1 + (round < 4 ? 0 : (size_t)rand() % 64);
+        for (size_t i = 0; i < n; i++) insert(&T, &M, M.n);
+        check(&T, &M);
+        while (M.n) {
+            remove_at(&T, &M, M.n - 1);
+            if (n - M.n < 200 || M.n % 64 == 0) check(&T, &M);
+        }
+    }
+
+    const size_t sizes[] = { 0, 1, 2, 63, 64, 65, 127, 4095, 4096, 4097, 4160, 4161, 262143, 262144, 262145 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        what = "built, then trimmed from the end";
+        step = 0;
+        build(&T, &M, sizes[s]);
+        check(&T, &M);
+        for (int i = 0; i < 300 && M.n; i++) {
+            remove_at(&T, &M, M.n - 1);
+            check(&T, &M);
+        }
+        what = "built, then edited at random";
+        step = 0;
+        build(&T, &M, sizes[s]);
+        for (int i = 0; i < 2000; i++) {
+            if (M.n && rand() % 2) remove_at(&T, &M, (size_t)rand() % M.n);
+            else insert(&T, &M, (size_t)rand() % (M.n + 1));
+            if (i % 8 == 0) check(&T, &M);
+        }
+        check(&T, &M);
+    }
+
+    what = "concatenated";
+    for (int round = 0; round < 40; round++) {
+        step = 0;
+        build(&T, &M, (size_t)rand() % (rand() % 2 ? 100 : 20000));
+        build(&U, &N, (size_t)rand() % (rand() % 2 ? 100 : 20000));
+        for (size_t i = 0; i < N.n; i++) model_insert(&M, M.n, N.id[i]);
+        N.n = 0;
+        linetree_concat(&T, &U);
+        check(&T, &M);
+        if (U.nlines) fail("concat left lines behind", U.nlines);
+        for (int i = 0; i < 500 && M.n; i++) {
+            remove_at(&T, &M, M.n - 1 - (size_t)rand() % (M.n < 100 ? M.n : 100));
+            check(&T, &M);
+        }
+    }
+
+    linetree_free(&T);
+    linetree_free(&U);
+    free(M.id);
+    free(N.id);
+    printf("check_linetree: ok\n");
+    return 0;
+}
@@ -1,29 +1,365 @@
-#include "editor_internal.h"
+#define _POSIX_C_SOURCE 200809L
+#include "buffer.h"
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-void editor_ensure_lines(Editor *E, size_t need) {
-    if (need <= E->cap) return;
-    size_t newcap = E->cap ? E->cap : 32;
-    while (newcap < need) newcap *= 2;
-    E->lines = xrealloc(E->lines, newcap * sizeof(Line));
-    E->cap = newcap;
-}
-
-void editor_insert_line(Editor *E, size_t at, Line ln) {
-    if (at > E->nlines) at = E->nlines;
-    editor_ensure_lines(E, E->nlines + 1);
-    memmove(&E->lines[at + 1], &E->lines[at], (E->nlines - at) * sizeof(Line));
-    E->lines[at] = ln;
-    E->nlines++;
-}
-
-void editor_delete_line(Editor *E, size_t at) {
-    if (at >= E->nlines) return;
-    line_free(&E->lines[at]);
-    memmove(&E->lines[at], &E->lines[at + 1], (E->nlines - at - 1) * sizeof(Line));
-    E->nlines--;
-    if (E->nlines == 0) {
-        editor_insert_line(E, 0, line_new_from("", 0));
+#include "loader.h"
+#include "util.h"
+
+#define ARENA_SLAB_SIZE 65536
+
+static bool in_orig(const Buffer *B, const char *p) {
+    return B->orig && p >= B->orig && p < B->orig + B->orig_len;
+}
+
+// A view outside the original text lives in the arena. Its slot belongs to
+// that line alone, so edits that do not grow the line happen in place.
+static bool in_arena(const Buffer *B, const Line *ln) {
+    return ln->cap == 0 && ln->len && !in_orig(B, ln->data);
+}
+
+// Free a line that is leaving the document, accounting for its arena slot.
+static void buffer_release(Buffer *B, Line *ln) {
+    if (in_arena(B, ln)) arena_release(&B->arena, ln->len);
+    line_free(ln);
+}
+
+static void buffer_clear(Buffer *B) {
+    if (B->loader) loader_free(B->loader);
+    linetree_free(&B->lines);
+    arena_free(&B->arena);
+    if (B->orig_mapped) munmap(B->orig, B->orig_len);
+    else free(B->orig);
+    if (B->orig_fd >= 0) close(B->orig_fd);
+    memset(B, 0, sizeof(*B));
+    B->orig_fd = -1;
+}
+
+void buffer_init(Buffer *B) {
+    memset(B, 0, sizeof(*B));
+    B->orig_fd = -1;
+    arena_init(&B->arena, ARENA_SLAB_SIZE);
+    linetree_init(&B->lines);
+    buffer_insert_line(B, 0, line_new_from("", 0));
+}
+
+void buffer_free(Buffer *B) {
+    buffer_clear(B);
+}
+
+// Take ownership of orig and index it as the original text. A mapped orig
+// is unmapped instead of freed.
+void buffer_load(Buffer *B, char *orig, size_t len, bool mapped) {
+    buffer_clear(B);
+    arena_init(&B->arena, ARENA_SLAB_SIZE);
+    B->orig = orig;
+    B->orig_len = len;
+    B->orig_mapped = mapped;
+
+    load_lines(orig, len, &B->lines);
+    if (B->lines.nlines == 0) buffer_insert_line(B, 0, line_new_from("", 0));
+}
+
+// Like buffer_load(), but index orig on a background thread. Returns as
+// soon as the first lines are in; buffer_poll() brings in the rest. Lines
+// only ever arrive at the end, so edits to what is loaded stay valid.
+void buffer_load_async(Buffer *B, char *orig, size_t len, bool mapped) {
+    buffer_clear(B);
+    arena_init(&B->arena, ARENA_SLAB_SIZE);
+    linetree_init(&B->lines);
+    B->orig = orig;
+    B->orig_len = len;
+    B->orig_mapped = mapped;
+
+    B->loader = loader_start(orig, len);
+    if (!B->loader) {
+        linetree_free(&B->lines);
+        load_lines(orig, len, &B->lines);
+    } else if (!loader_poll(B->loader, &B->lines, true)) {
+        loader_free(B->loader);
+        B->loader = NULL;
+    }
+
+    if (B->lines.nlines == 0) buffer_insert_line(B, 0, line_new_from("", 0));
+}
+
+// Bring in lines indexed since the last call. Returns true while the
+// load is still running.
+bool buffer_poll(Buffer *B) {
+    if (!B->loader) return false;
+    if (loader_poll(B->loader, &B->lines, false)) return true;
+    loader_free(B->loader);
+    B->loader = NULL;
+    return false;
+}
+
+// Block until the whole of orig is indexed.
+void buffer_finish_load(Buffer *B) {
+    if (!B->loader) return;
+    while (loader_poll(B->loader, &B->lines, true)) {}
+    loader_free(B->loader);
+    B->loader = NULL;
+}
+
+bool buffer_loading(const Buffer *B) {
+    return B->loader != NULL;
+}
+
+int buffer_load_percent(const Buffer *B) {
+    if (!B->loader || !B->orig_len) return 100;
+    return (int)(loader_done(B->loader) * 100 / B->orig_len);
+}
+
+// Remember the file orig was read from, so a save can copy unchanged text
+// from it instead of writing it out of memory. fd is duplicated; files
+// that are not regular or do not match orig are ignored.
+void buffer_set_source(Buffer *B, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size != B->orig_len) return;
+    B->orig_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    B->orig_mtime = st.st_mtim;
+}
+
+void buffer_pin(Buffer *B) {
+    B->pinned++;
+}
+
+void buffer_unpin(Buffer *B) {
+    B->pinned--;
+}
+
+size_t buffer_nlines(const Buffer *B) {
+    return B->lines.nlines;
+}
+
+size_t buffer_bytes(const Buffer *B) {
+    return B->lines.bytes;
+}
+
+const Line *buffer_line(Buffer *B, size_t at) {
+    return linetree_get(&B->lines, at);
+}
+
+size_t buffer_line_offset(Buffer *B, size_t at) {
+    return linetree_offset(&B->lines, at);
+}
+
+size_t buffer_line_at_offset(Buffer *B, size_t off) {
+    return linetree_line_at(&B->lines, off);
+}
+
+// In-order walk from line `at`, without a lookup per line. The buffer
+// must not change while the walk is in progress.
+void buffer_iter(Buffer *B, size_t at, LtIter *it) {
+    linetree_iter_begin(&B->lines, at, it);
+}
+
+const Line *buffer_iter_next(LtIter *it) {
+    return linetree_iter_next(it);
+}
+
+void buffer_insert_line(Buffer *B, size_t at, Line ln) {
+    linetree_insert(&B->lines, at, ln);
+}
+
+void buffer_delete_line(Buffer *B, size_t at) {
+    if (at >= B->lines.nlines) return;
+    Line ln = linetree_remove(&B->lines, at);
+    buffer_release(B, &ln);
+    if (B->lines.nlines == 0) {
+        buffer_insert_line(B, 0, line_new_from("", 0));
+    }
+}
+
+// Growing a line moves it to its own allocation.
+void buffer_insert_char(Buffer *B, size_t y, size_t x, int ch) {
+    Line *ln = linetree_get(&B->lines, y);
+    if (in_arena(B, ln)) arena_release(&B->arena, ln->len);
+    line_insert_char(ln, x, ch);
+    linetree_resized(&B->lines, y, 1);
+}
+
+// Delete n bytes of line y at x. A view that loses its first or last bytes
+// just gets narrower; otherwise shrinking keeps the line in the arena: an
+// original line is copied in at its exact size, an arena line shrinks in
+// place (unless pinned, when it is copied as well).
+static void buffer_delete_bytes(Buffer *B, size_t y, size_t x, size_t n) {
+    Line *ln = linetree_get(&B->lines, y);
+    if (x >= ln->len || !n) return;
+    if (n > ln->len - x) n = ln->len - x;
+    if (ln->cap == 0 && (x == 0 || x + n == ln->len)) {
+        if (in_arena(B, ln)) arena_release(&B->arena, n);
+        if (x == 0) ln->data += n;
+        ln->len -= n;
+        linetree_resized(&B->lines, y, -(ptrdiff_t)n);
+        return;
+    }
+    if (ln->cap == 0 && (in_orig(B, ln->data) || B->pinned)) {
+        char *d = arena_dup(&B->arena, ln->data, ln->len);
+        if (in_arena(B, ln)) arena_release(&B->arena, ln->len);
+        ln->data = d;
+    }
+    if (in_arena(B, ln)) {
+        memmove(ln->data + x, ln->data + x + n, ln->len - x - n);
+        ln->len -= n;
+        arena_release(&B->arena, n);
+    } else if (n == 1) {
+        line_del_char(ln, x);
+    } else {
+        line_delete(ln, x, n);
+    }
+    linetree_resized(&B->lines, y, -(ptrdiff_t)n);
+}
+
+void buffer_delete_char(Buffer *B, size_t y, size_t x) {
+    buffer_delete_bytes(B, y, x, 1);
+}
+
+void buffer_split_line(Buffer *B, size_t y, size_t x) {
+    Line *ln = linetree_get(&B->lines, y);
+    if (x > ln->len) x = ln->len;
+    size_t n = ln->len - x;
+
+    // The right half stays a piece of the same storage when ln is a view;
+    // otherwise it moves to the arena.
+    Line right = {0};
+    const char *d = line_data(ln);
+    if (n && ln->cap == 0) right = line_view(d + x, n);
+    else if (n) right = line_view(arena_dup(&B->arena, d + x, n), n);
+
+    line_truncate(ln, x);
+    linetree_resized(&B->lines, y, -(ptrdiff_t)n);
+    buffer_insert_line(B, y + 1, right);
+}
+
+void buffer_join_lines(Buffer *B, size_t y) {
+    if (y + 1 >= B->lines.nlines) return;
+    Line *ln = linetree_get(&B->lines, y);
+    Line *next = linetree_get(&B->lines, y + 1);
+    size_t n = next->len;
+    const char *nd = line_data(next);
+
+    // Adjacent pieces (a split that is being undone) just widen the view;
+    // next's bytes now belong to ln.
+    if (ln->cap == 0 && ln->data && ln->data + ln->len == nd) {
+        ln->len += n;
+        linetree_resized(&B->lines, y, (ptrdiff_t)n);
+        linetree_remove(&B->lines, y + 1);
+        return;
+    }
+    // Appending moves ln to its own allocation
+    if (n && in_arena(B, ln)) arena_release(&B->arena, ln->len);
+    line_append(ln, nd, n);
+    linetree_resized(&B->lines, y, (ptrdiff_t)n);
+    buffer_delete_line(B, y + 1);
+}
+
+// The text after the first newline is copied into the arena once, and the
+// lines it makes are views of that copy.
+void buffer_insert_text(Buffer *B, size_t y, size_t x, const char *s, size_t n, size_t *ey, size_t *ex) {
+    Line *ln = linetree_get(&B->lines, y);
+    if (x > ln->len) x = ln->len;
+    const char *nl = memchr(s, '\n', n);
+    if (!nl) {
+        if (n && in_arena(B, ln)) arena_release(&B->arena, ln->len);
+        line_insert(ln, x, s, n);
+        linetree_resized(&B->lines, y, (ptrdiff_t)n);
+        *ey = y;
+        *ex = x + n;
+        return;
+    }
+
+    // y keeps what is left of x plus the first line of text; the rest of
+    // it waits at y + 1 for the last line of text.
+    buffer_split_line(B, y, x);
+    ln = linetree_get(&B->lines, y);
+    size_t first = (size_t)(nl - s);
+    if (first && in_arena(B, ln)) arena_release(&B->arena, ln->len);
+    line_append(ln, s, first);
+    linetree_resized(&B->lines, y, (ptrdiff_t)first);
+
+    size_t m = n - first - 1;
+    char *d = arena_dup(&B->arena, nl + 1, m);
+    const char *p = d, *end = d + m;
+    size_t at = y + 1;
+    while ((nl = memchr(p, '\n', (size_t)(end - p)))) {
+        size_t len = (size_t)(nl - p);
+        buffer_insert_line(B, at++, len ? line_view(p, len) : (Line){0});
+        p = nl + 1;
+    }
+    // the newlines, and the last line, which is copied out below
+    size_t last = (size_t)(end - p);
+    arena_release(&B->arena, last + (at - y - 1));
+    if (last) {
+        Line *right = linetree_get(&B->lines, at);
+        Line joined = line_new_from(p, last);
+        line_append(&joined, line_data(right), right->len);
+        buffer_release(B, right);
+        *right = joined;
+        linetree_resized(&B->lines, at, (ptrdiff_t)last);
+    }
+    *ey = at;
+    *ex = last;
+}
+
+// The two ends are cut down first, so that joining them copies no more
+// than what is kept.
+void buffer_delete_range(Buffer *B, size_t y0, size_t x0, size_t y1, size_t x1) {
+    if (y1 >= B->lines.nlines) {
+        y1 = B->lines.nlines - 1;
+        x1 = linetree_get(&B->lines, y1)->len;
+    }
+    if (y0 > y1 || (y0 == y1 && x0 >= x1)) return;
+    if (y0 == y1) {
+        buffer_delete_bytes(B, y0, x0, x1 - x0);
+        return;
+    }
+    buffer_delete_bytes(B, y1, 0, x1);
+    buffer_delete_bytes(B, y0, x0, SIZE_MAX);
+    for (size_t y = y0 + 1; y < y1; y++) buffer_delete_line(B, y0 + 1);
+    buffer_join_lines(B, y0);
+}
+
+// Copy bytes [from, to) of ln to d, across its gap.
+static void copy_bytes(const Line *ln, size_t from, size_t to, char *d) {
+    for (size_t x = from, k; x < to; x += k) {
+        const char *p = line_peek(ln, x, &k);
+        if (k > to - x) k = to - x;
+        memcpy(d + (x - from), p, k);
+    }
+}
+
+// Every line with spans is rebuilt once, into an arena slot of its final
+// size; the old text is left alone, so a pinned snapshot still reads it.
+void buffer_replace_spans(Buffer *B, const BufferEdit *e, size_t n) {
+    for (size_t i = 0, j; i < n; i = j) {
+        size_t y = e[i].y;
+        Line *ln = linetree_get(&B->lines, y);
+        size_t len = ln->len, newlen = len;
+        for (j = i; j < n && e[j].y == y; j++) newlen = newlen - e[j].n + e[j].slen;
+
+        Line nw = {0};
+        if (newlen) {
+            char *d = arena_alloc(&B->arena, newlen), *out = d;
+            size_t at = 0;
+            for (size_t k = i; k < j; k++) {
+                copy_bytes(ln, at, e[k].x, out);
+                out += e[k].x - at;
+                if (e[k].slen) memcpy(out, e[k].s, e[k].slen);
+                out += e[k].slen;
+                at = e[k].x + e[k].n;
+            }
+            copy_bytes(ln, at, len, out);
+            nw = line_view(d, newlen);
+        }
+        buffer_release(B, ln);
+        *ln = nw;
+        linetree_resized(&B->lines, y, (ptrdiff_t)newlen - (ptrdiff_t)len);
     }
 }
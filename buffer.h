@@ -0,0 +1,87 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "arena.h"
+#include "linetree.h"
+
+typedef struct Loader Loader;
+
+// The document. Text lives in three places: the original file contents,
+// kept read-only; an arena for text created while editing; and the heap.
+// Lines start out as views (pieces) into the first two. An edit that
+// shrinks a line keeps it in the arena; only a line that grows moves to
+// its own heap allocation.
+//
+// Lines returned by buffer_line() are read-only to callers: every change
+// goes through the buffer_* operations so the line index stays in sync.
+typedef struct {
+    char  *orig;
+    size_t orig_len;
+    bool   orig_mapped; // orig is a file mapping rather than a heap block
+    int    orig_fd;     // the file orig was loaded from, or -1
+    struct timespec orig_mtime;
+
+    Arena arena;
+    int   pinned; // snapshots reading orig and the arena; see buffer_pin()
+
+    LineTree lines;
+    Loader  *loader; // non-NULL while orig is still being indexed
+} Buffer;
+
+void   buffer_init(Buffer *B);
+void   buffer_free(Buffer *B);
+void   buffer_load(Buffer *B, char *orig, size_t len, bool mapped);
+void   buffer_load_async(Buffer *B, char *orig, size_t len, bool mapped);
+bool   buffer_poll(Buffer *B);
+void   buffer_finish_load(Buffer *B);
+bool   buffer_loading(const Buffer *B);
+int    buffer_load_percent(const Buffer *B);
+void   buffer_set_source(Buffer *B, int fd);
+
+// While pinned, the bytes of orig and the arena never change: edits that
+// would shrink an arena line in place copy it first. The buffer must not
+// be reloaded or freed while pinned.
+void   buffer_pin(Buffer *B);
+void   buffer_unpin(Buffer *B);
+
+size_t buffer_nlines(const Buffer *B);
+size_t buffer_bytes(const Buffer *B);
+const Line *buffer_line(Buffer *B, size_t at);
+size_t buffer_line_offset(Buffer *B, size_t at);
+size_t buffer_line_at_offset(Buffer *B, size_t off);
+void   buffer_iter(Buffer *B, size_t at, LtIter *it);
+const Line *buffer_iter_next(LtIter *it);
+
+void   buffer_insert_line(Buffer *B, size_t at, Line ln);
+void   buffer_delete_line(Buffer *B, size_t at);
+
+void   buffer_insert_char(Buffer *B, size_t y, size_t x, int ch);
+void   buffer_delete_char(Buffer *B, size_t y, size_t x);
+void   buffer_split_line(Buffer *B, size_t y, size_t x);
+void   buffer_join_lines(Buffer *B, size_t y);
+
+// Range edits, in time proportional to the bytes and lines they touch.
+// Insert n bytes of text at (y, x), starting a new line at every '\n', in
+// one pass over the text. *ey, *ex are set to the position just after it.
+void   buffer_insert_text(Buffer *B, size_t y, size_t x, const char *s, size_t n, size_t *ey, size_t *ex);
+// Delete from (y0, x0) up to (y1, x1), newlines in between included.
+void   buffer_delete_range(Buffer *B, size_t y0, size_t x0, size_t y1, size_t x1);
+
+// One span of a multi-span replace: the n bytes at (y, x) become the slen
+// bytes at s, which hold no '\n'.
+typedef struct {
+    size_t y, x, n;
+    const char *s;
+    size_t slen;
+} BufferEdit;
+
+// Replace n spans at once, each line being rebuilt in one pass at its
+// final length. The spans are in document order, do not overlap and stay
+// within their line; positions are those before the replace.
+void   buffer_replace_spans(Buffer *B, const BufferEdit *e, size_t n);
+
+#endif
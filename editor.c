@@ -3,215 +3,760 @@
 #include <ctype.h>
 #include <ncurses.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
-static void editor_insert_char(Editor *E, int ch) {
-    Line *ln = &E->lines[E->cy];
-    line_insert_char(ln, E->cx, ch);
-    E->cx++;
+#include "journal.h"
+#include "save.h"
+#include "screen.h"
+
+// Memory the undo history may use before it forgets the oldest edits.
+#define EDITOR_UNDO_LIMIT (64u << 20)
+
+// Edits are counted so that a background save can tell whether the
+// document changed while it was being written.
+static void editor_mark_dirty(Editor *E) {
     E->dirty = true;
+    E->changes++;
 }
 
-static void editor_insert_newline(Editor *E) {
-    Line *ln = &E->lines[E->cy];
+// Mark document lines [lo, hi) for redrawing.
+void editor_damage(Editor *E, size_t lo, size_t hi) {
+    if (E->damage_lo >= E->damage_hi) {
+        E->damage_lo = lo;
+        E->damage_hi = hi;
+        return;
+    }
+    if (lo < E->damage_lo) E->damage_lo = lo;
+    if (hi > E->damage_hi) E->damage_hi = hi;
+}
 
-    // split ln at cx
-    size_t left_len = E->cx;
-    if (left_len > ln->len) left_len = ln->len;
-    size_t right_len = ln->len - left_len;
+// The column map of line y, folded as the view is, reusing the one used
+// least recently when the line has none.
+static WidthMap *editor_width(Editor *E, size_t y) {
+    size_t wrap = E->wrap ? E->wraps.cols : 0;
+    WidthMap *M = &E->widths[0];
+    for (size_t i = 0; i < E->nwidths; i++) {
+        if (E->widths[i].y == y) {
+            M = &E->widths[i];
+            break;
+        }
+        if (E->widths[i].used < M->used) M = &E->widths[i];
+    }
+    if (M->y != y || M->wrap != wrap) width_reset(M, y, wrap);
+    M->used = ++E->width_tick;
+    return M;
+}
 
-    Line right = line_new_from(ln->data + left_len, right_len);
+// Keep a column map for every text row and the cursor line. Maps handed
+// out earlier move, so this runs only before a frame.
+static void editor_size_widths(Editor *E) {
+    size_t n = E->screen_rows > 0 ? (size_t)E->screen_rows + 1 : 0;
+    if (n < EDITOR_WIDTHS) n = EDITOR_WIDTHS;
+    if (n <= E->nwidths) return;
+    E->widths = xrealloc(E->widths, n * sizeof(WidthMap));
+    for (size_t i = E->nwidths; i < n; i++) width_init(&E->widths[i]);
+    E->nwidths = n;
+}
 
-    ln->len = left_len;
-    if (ln->data) ln->data[ln->len] = '\0';
+// Soft wrap: measure the lines an edit left. When line y now takes a
+// different number of rows, every row below it moves.
+static void editor_rewrap(Editor *E, size_t y, size_t removed, size_t added) {
+    WrapTree *W = &E->wraps;
+    size_t rows = wrap_rows(W, y);
+    wrap_remove(W, y + 1, removed);
+    if (added) {
+        LtIter it;
+        bool wide;
+        buffer_iter(&E->buf, y + 1, &it);
+        for (size_t i = 1; i <= added; i++) {
+            size_t width = width_line(buffer_iter_next(&it), W->cols, &wide);
+            wrap_insert(W, y + i, width, wide);
+        }
+    }
+    const Line *ln = buffer_line(&E->buf, y);
+    WidthMap *M = editor_width(E, y);
+    size_t width = width_col(M, ln, ln->len);
+    wrap_set(W, y, width, M->wide);
+    if (wrap_rows(W, y) != rows) editor_damage(E, y, SIZE_MAX);
+}
 
-    editor_insert_line(E, E->cy + 1, right);
+// Line y changed from byte x on, all but its last `tail` bytes, and the
+// `removed` lines after it were replaced by `added` new ones: forget what
+// was worked out about them.
+static void editor_edited(Editor *E, size_t y, size_t x, size_t tail, size_t removed,
+                          size_t added) {
+    for (size_t i = 0; i < E->nwidths; i++) {
+        WidthMap *M = &E->widths[i];
+        if (M->y == y) width_edit(M, buffer_line(&E->buf, y), x, tail);
+        else if ((removed || added) && M->y != SIZE_MAX && M->y > y) width_reset(M, SIZE_MAX, 0);
+    }
+    syntax_edit(&E->syntax, y, removed, added);
+    if (E->wrap) editor_rewrap(E, y, removed, added);
+}
 
+static void editor_log(Editor *E, JournalOp op, size_t y, size_t x, int ch) {
+    if (E->journal) journal_log(E->journal, op, y, x, ch);
+}
+
+// Range edits, used for pastes and by undo/redo. The cursor is left
+// after inserted text and at the start of deleted text.
+static void editor_insert_text(Editor *E, size_t y, size_t x, const char *s, size_t n) {
+    size_t ey, ex;
+    if (E->journal) journal_log_text(E->journal, y, x, s, n);
+    buffer_insert_text(&E->buf, y, x, s, n, &ey, &ex);
+    editor_edited(E, y, x, ey == y ? buffer_line(&E->buf, y)->len - ex : 0, 0, ey - y);
+    editor_damage(E, y, ey == y ? y + 1 : SIZE_MAX);
+    E->cy = ey;
+    E->cx = ex;
+    editor_mark_dirty(E);
+}
+
+static void editor_delete_range(Editor *E, size_t y0, size_t x0, size_t y1, size_t x1) {
+    if (E->journal) journal_log_erase(E->journal, y0, x0, y1, x1);
+    buffer_delete_range(&E->buf, y0, x0, y1, x1);
+    editor_edited(E, y0, x0, y1 == y0 ? buffer_line(&E->buf, y0)->len - x0 : 0, y1 - y0, 0);
+    editor_damage(E, y0, y1 == y0 ? y0 + 1 : SIZE_MAX);
+    E->cy = y0;
+    E->cx = x0;
+    editor_mark_dirty(E);
+}
+
+// Replace n spans at once (see buffer_replace_spans()). The cursor stays
+// on its line, within it.
+void editor_replace_spans(Editor *E, const BufferEdit *e, size_t n) {
+    if (!n) return;
+    if (E->journal) journal_log_spans(E->journal, e, n);
+    buffer_replace_spans(&E->buf, e, n);
+    for (size_t i = 0, k; i < n; i = k) {
+        // the spans on one line, and where the last of them now ends
+        size_t end = 0, shift = 0;
+        for (k = i; k < n && e[k].y == e[i].y; k++) {
+            end = e[k].x + shift + e[k].slen;
+            shift += e[k].slen - e[k].n;
+        }
+        editor_edited(E, e[i].y, e[i].x, buffer_line(&E->buf, e[i].y)->len - end, 0, 0);
+    }
+    editor_damage(E, e[0].y, e[n - 1].y + 1);
+    size_t len = buffer_line(&E->buf, E->cy)->len;
+    if (E->cx > len) E->cx = len;
+    editor_mark_dirty(E);
+}
+
+// A paste goes into the buffer as one block rather than key by key.
+static void editor_paste(Editor *E) {
+    size_t n;
+    const char *s = screen_paste(&n);
+    if (!n) return;
+    undo_insert(&E->undo, E->cy, E->cx, s, n);
+    editor_insert_text(E, E->cy, E->cx, s, n);
+}
+
+// Put a step back (undo) or make it again (redo): either way one insert or
+// one delete of its whole text, or one replace of all its spans.
+static void editor_apply_step(Editor *E, const UndoStep *st, bool undo) {
+    if (st->kind == UNDO_REPLACE) {
+        BufferEdit *e = xmalloc(st->nspans * sizeof(BufferEdit));
+        undo_spans(st, undo, e);
+        editor_replace_spans(E, e, st->nspans);
+        free(e);
+        E->cy = st->y;
+        E->cx = st->x;
+        return;
+    }
+    if (st->kind == (undo ? UNDO_INSERT : UNDO_DELETE)) {
+        editor_delete_range(E, st->y, st->x, st->ey, st->ex);
+        return;
+    }
+    editor_insert_text(E, st->y, st->x, undo_text(&E->undo, st), st->n);
+    // text put back by undoing Delete goes after the cursor
+    if (st->kind == UNDO_DELETE && !st->back) {
+        E->cy = st->y;
+        E->cx = st->x;
+    }
+}
+
+static void editor_undo(Editor *E) {
+    const UndoStep *st = undo_undo(&E->undo);
+    if (!st) {
+        editor_set_msg(E, "Nothing to undo");
+        return;
+    }
+    editor_apply_step(E, st, true);
+}
+
+static void editor_redo(Editor *E) {
+    const UndoStep *st = undo_redo(&E->undo);
+    if (!st) {
+        editor_set_msg(E, "Nothing to redo");
+        return;
+    }
+    editor_apply_step(E, st, false);
+}
+
+static void editor_insert_char(Editor *E, int ch) {
+    char c = (char)ch;
+    undo_insert(&E->undo, E->cy, E->cx, &c, 1);
+    editor_log(E, JOURNAL_INSERT, E->cy, E->cx, ch);
+    buffer_insert_char(&E->buf, E->cy, E->cx, ch);
+    editor_edited(E, E->cy, E->cx, buffer_line(&E->buf, E->cy)->len - E->cx - 1, 0, 0);
+    editor_damage(E, E->cy, E->cy + 1);
+    E->cx++;
+    editor_mark_dirty(E);
+}
+
+static void editor_insert_newline(Editor *E) {
+    undo_insert(&E->undo, E->cy, E->cx, "\n", 1);
+    editor_log(E, JOURNAL_SPLIT, E->cy, E->cx, 0);
+    buffer_split_line(&E->buf, E->cy, E->cx);
+    editor_edited(E, E->cy, E->cx, 0, 0, 1);
+    editor_damage(E, E->cy, SIZE_MAX);
     E->cy++;
     E->cx = 0;
-    E->dirty = true;
+    editor_mark_dirty(E);
 }
 
 static void editor_backspace(Editor *E) {
     if (E->cy == 0 && E->cx == 0) return;
 
-    Line *ln = &E->lines[E->cy];
     if (E->cx > 0) {
-        line_del_char(ln, E->cx - 1);
-        E->cx--;
+        // the whole character before the cursor, a byte at a time
+        size_t from = width_prev(buffer_line(&E->buf, E->cy), E->cx);
+        while (E->cx > from) {
+            size_t n;
+            const char *p = line_peek(buffer_line(&E->buf, E->cy), E->cx - 1, &n);
+            undo_delete(&E->undo, E->cy, E->cx - 1, p, 1, true);
+            editor_log(E, JOURNAL_DELETE, E->cy, E->cx - 1, 0);
+            buffer_delete_char(&E->buf, E->cy, E->cx - 1);
+            E->cx--;
+        }
+        editor_edited(E, E->cy, from, buffer_line(&E->buf, E->cy)->len - from, 0, 0);
+        editor_damage(E, E->cy, E->cy + 1);
     } else {
         // merge with previous line
-        Line *prev = &E->lines[E->cy - 1];
-        size_t old_prev_len = prev->len;
-        line_ensure_cap(prev, prev->len + ln->len + 1);
-        memcpy(prev->data + prev->len, ln->data, ln->len);
-        prev->len += ln->len;
-        prev->data[prev->len] = '\0';
-
-        editor_delete_line(E, E->cy);
+        size_t old_prev_len = buffer_line(&E->buf, E->cy - 1)->len;
+        undo_delete(&E->undo, E->cy - 1, old_prev_len, "\n", 1, true);
+        editor_log(E, JOURNAL_JOIN, E->cy - 1, 0, 0);
+        buffer_join_lines(&E->buf, E->cy - 1);
+        editor_edited(E, E->cy - 1, old_prev_len, 0, 1, 0);
+        editor_damage(E, E->cy - 1, SIZE_MAX);
         E->cy--;
         E->cx = old_prev_len;
     }
-    E->dirty = true;
+    editor_mark_dirty(E);
 }
 
 static void editor_delete(Editor *E) {
-    Line *ln = &E->lines[E->cy];
+    const Line *ln = buffer_line(&E->buf, E->cy);
     if (E->cx < ln->len) {
-        line_del_char(ln, E->cx);
-        E->dirty = true;
+        // the whole character under the cursor, a byte at a time
+        size_t w, k = width_at(ln, E->cx, 0, &w, NULL, NULL);
+        while (k--) {
+            size_t n;
+            ln = buffer_line(&E->buf, E->cy);
+            undo_delete(&E->undo, E->cy, E->cx, line_peek(ln, E->cx, &n), 1, false);
+            editor_log(E, JOURNAL_DELETE, E->cy, E->cx, 0);
+            buffer_delete_char(&E->buf, E->cy, E->cx);
+        }
+        editor_edited(E, E->cy, E->cx, buffer_line(&E->buf, E->cy)->len - E->cx, 0, 0);
+        editor_damage(E, E->cy, E->cy + 1);
+        editor_mark_dirty(E);
         return;
     }
     // at end: merge with next line
-    if (E->cy + 1 >= E->nlines) return;
-    Line *next = &E->lines[E->cy + 1];
-    line_ensure_cap(ln, ln->len + next->len + 1);
-    memcpy(ln->data + ln->len, next->data, next->len);
-    ln->len += next->len;
-    ln->data[ln->len] = '\0';
-    editor_delete_line(E, E->cy + 1);
-    E->dirty = true;
+    if (E->cy + 1 >= buffer_nlines(&E->buf)) return;
+    undo_delete(&E->undo, E->cy, ln->len, "\n", 1, false);
+    editor_log(E, JOURNAL_JOIN, E->cy, 0, 0);
+    size_t len = ln->len;
+    buffer_join_lines(&E->buf, E->cy);
+    editor_edited(E, E->cy, len, 0, 1, 0);
+    editor_damage(E, E->cy, SIZE_MAX);
+    editor_mark_dirty(E);
+}
+
+// Rows of text on screen; the last two are the status and message lines.
+static int editor_text_rows(const Editor *E) {
+    int n = E->screen_rows - 2;
+    return n < 1 ? 1 : n;
+}
+
+// Put the cursor on line y at the character covering display column col.
+static void editor_to_col(Editor *E, size_t y, size_t col) {
+    size_t start;
+    E->cy = y;
+    E->cx = width_byte(editor_width(E, y), buffer_line(&E->buf, y), col, &start);
+}
+
+// Soft wrap: move the cursor n screen rows up or down, to the same column
+// within the row.
+static void editor_wrap_move(Editor *E, size_t col, size_t n, bool up) {
+    WrapTree *W = &E->wraps;
+    size_t r = wrap_row(W, E->cy) + col / W->cols, sub;
+    if (up) r -= r < n ? r : n;
+    else r += n;
+    size_t y = wrap_line(W, r, &sub), start, w;
+    const Line *ln = buffer_line(&E->buf, y);
+    size_t at = sub * W->cols + col % W->cols;
+    E->cy = y;
+    E->cx = width_byte(editor_width(E, y), ln, at, &start);
+    // a tab cut by the edge belongs to the row it starts on, and the blank
+    // before a character moved to the next row to the one before it
+    if (start < sub * W->cols && E->cx < ln->len) {
+        E->cx += width_at(ln, E->cx, start, &w, NULL, NULL);
+    } else if (start > at && E->cx > 0) {
+        E->cx = width_prev(ln, E->cx);
+    }
 }
 
 static void editor_move_cursor(Editor *E, int key) {
-    Line *ln = &E->lines[E->cy];
+    const Line *ln = buffer_line(&E->buf, E->cy);
+    undo_seal(&E->undo);
+
+    // vertical moves keep the display column, not the byte offset
+    size_t col = 0;
+    if (key == KEY_UP || key == KEY_DOWN || key == KEY_PPAGE || key == KEY_NPAGE) {
+        col = width_col(editor_width(E, E->cy), ln, E->cx);
+    }
 
+    size_t w;
     switch (key) {
         case KEY_LEFT:
-            if (E->cx > 0) E->cx--;
+            if (E->cx > 0) E->cx = width_prev(ln, E->cx);
             else if (E->cy > 0) {
                 E->cy--;
-                E->cx = E->lines[E->cy].len;
+                E->cx = buffer_line(&E->buf, E->cy)->len;
             }
             break;
         case KEY_RIGHT:
-            if (E->cx < ln->len) E->cx++;
-            else if (E->cy + 1 < E->nlines) {
+            if (E->cx < ln->len) E->cx += width_at(ln, E->cx, 0, &w, NULL, NULL);
+            else if (E->cy + 1 < buffer_nlines(&E->buf)) {
                 E->cy++;
                 E->cx = 0;
             }
             break;
         case KEY_UP:
-            if (E->cy > 0) E->cy--;
+            if (E->wrap) editor_wrap_move(E, col, 1, true);
+            else if (E->cy > 0) editor_to_col(E, E->cy - 1, col);
             break;
         case KEY_DOWN:
-            if (E->cy + 1 < E->nlines) E->cy++;
+            if (E->wrap) editor_wrap_move(E, col, 1, false);
+            else if (E->cy + 1 < buffer_nlines(&E->buf)) editor_to_col(E, E->cy + 1, col);
             break;
         case KEY_HOME:
             E->cx = 0;
             break;
         case KEY_END:
-            E->cx = E->lines[E->cy].len;
+            E->cx = buffer_line(&E->buf, E->cy)->len;
             break;
-        case KEY_PPAGE: // Page Up
-            for (int i = 0; i < E->screen_rows - 2; i++) editor_move_cursor(E, KEY_UP);
+        case KEY_PPAGE: { // Page Up: cursor and view move together
+            size_t page = (size_t)editor_text_rows(E);
+            if (E->wrap) {
+                size_t top = wrap_row(&E->wraps, E->rowoff) + E->rowsub;
+                editor_wrap_move(E, col, page, true);
+                E->rowoff = wrap_line(&E->wraps, top - (top < page ? top : page), &E->rowsub);
+                break;
+            }
+            editor_to_col(E, E->cy - (E->cy < page ? E->cy : page), col);
+            E->rowoff -= E->rowoff < page ? E->rowoff : page;
             break;
-        case KEY_NPAGE: // Page Down
-            for (int i = 0; i < E->screen_rows - 2; i++) editor_move_cursor(E, KEY_DOWN);
+        }
+        case KEY_NPAGE: { // Page Down
+            size_t page = (size_t)editor_text_rows(E);
+            if (E->wrap) {
+                size_t top = wrap_row(&E->wraps, E->rowoff) + E->rowsub + page;
+                editor_wrap_move(E, col, page, false);
+                col = width_col(editor_width(E, E->cy), buffer_line(&E->buf, E->cy), E->cx);
+                size_t row = wrap_row(&E->wraps, E->cy) + col / E->wraps.cols;
+                E->rowoff = wrap_line(&E->wraps, top < row ? top : row, &E->rowsub);
+                break;
+            }
+            size_t last = buffer_nlines(&E->buf) - 1;
+            editor_to_col(E, E->cy + (last - E->cy < page ? last - E->cy : page), col);
+            E->rowoff += page;
+            if (E->rowoff > E->cy) E->rowoff = E->cy;
             break;
+        }
     }
 
     // clamp cx to line length
-    ln = &E->lines[E->cy];
+    ln = buffer_line(&E->buf, E->cy);
     if (E->cx > ln->len) E->cx = ln->len;
 }
 
-static void editor_scroll(Editor *E) {
-    int text_rows = E->screen_rows - 2; // last 2 lines: status + message
-    if (text_rows < 1) text_rows = 1;
+// Bring the cursor into view. Returns its display column.
+static size_t editor_scroll(Editor *E) {
+    int text_rows = editor_text_rows(E);
+
+    if (E->wrap) {
+        // in screen rows from the top of the document
+        size_t col = width_col(editor_width(E, E->cy), buffer_line(&E->buf, E->cy), E->cx);
+        size_t row = wrap_row(&E->wraps, E->cy) + col / E->wraps.cols;
+        size_t top = wrap_row(&E->wraps, E->rowoff) + E->rowsub;
+        if (row < top) top = row;
+        if (row >= top + (size_t)text_rows) top = row - (size_t)text_rows + 1;
+        E->rowoff = wrap_line(&E->wraps, top, &E->rowsub);
+        E->coloff = 0;
+        return col;
+    }
 
     if (E->cy < E->rowoff) E->rowoff = E->cy;
     if (E->cy >= E->rowoff + (size_t)text_rows) E->rowoff = E->cy - (size_t)text_rows + 1;
 
-    if (E->cx < E->coloff) E->coloff = E->cx;
-    if (E->cx >= E->coloff + (size_t)E->screen_cols) E->coloff = E->cx - (size_t)E->screen_cols + 1;
+    // the whole of the character under the cursor, if it fits
+    const Line *ln = buffer_line(&E->buf, E->cy);
+    size_t col = width_col(editor_width(E, E->cy), ln, E->cx), w = 1;
+    if (E->cx < ln->len) width_at(ln, E->cx, col, &w, NULL, NULL);
+    size_t cols = (size_t)E->screen_cols;
+    if (w > cols) w = cols;
+    if (col < E->coloff) E->coloff = col;
+    if (col + w > E->coloff + cols) E->coloff = col + w - cols;
+    return col;
 }
 
-void editor_refresh_screen(Editor *E) {
-    getmaxyx(stdscr, E->screen_rows, E->screen_cols);
-    editor_scroll(E);
+static void editor_draw_glyphs(Editor *E, size_t n) {
+    if (n) screen_addnstr(E->glyphs, (int)n);
+}
 
-    int text_rows = E->screen_rows - 2;
-    if (text_rows < 1) text_rows = 1;
+static const ScreenColor syntax_colors[] = {
+    [SYN_PLAIN] = SCREEN_DEFAULT,
+    [SYN_COMMENT] = SCREEN_BLUE,
+    [SYN_KEYWORD] = SCREEN_YELLOW,
+    [SYN_TYPE] = SCREEN_CYAN,
+    [SYN_STRING] = SCREEN_GREEN,
+    [SYN_NUMBER] = SCREEN_MAGENTA,
+    [SYN_PREPROC] = SCREEN_MAGENTA,
+    [SYN_KEY] = SCREEN_CYAN,
+    [SYN_LITERAL] = SCREEN_MAGENTA,
+    [SYN_ERROR] = SCREEN_RED,
+    [SYN_WARN] = SCREEN_YELLOW,
+    [SYN_INFO] = SCREEN_GREEN,
+};
+
+// Draw the display columns [left, left + screen_cols) of a line. A tab or
+// wide character cut by either edge shows as blanks (with soft wrap, only
+// a tab: the others start the next row); text is colored by
+// its syntax, and matches of the search query are reversed.
+static void editor_draw_row(Editor *E, int y, size_t filerow, size_t left) {
+    screen_move(y, 0);
+    screen_clrtoeol();
+
+    if (filerow >= buffer_nlines(&E->buf)) {
+        screen_addch('~');
+        return;
+    }
 
-    erase();
+    const Line *ln = buffer_line(&E->buf, filerow);
+    size_t cols = (size_t)E->screen_cols, right = left + cols;
+    size_t col, x = width_byte(editor_width(E, filerow), ln, left, &col);
 
-    // draw text area
-    for (int y = 0; y < text_rows; y++) {
-        size_t filerow = E->rowoff + (size_t)y;
-        move(y, 0);
-        clrtoeol();
+    // no glyph takes more than 4 bytes a column, nor a row more than this
+    size_t cap = cols * 4 + WIDTH_GLYPH_MAX;
+    if (cap > E->glyphcap) {
+        E->glyphcap = cap;
+        E->glyphs = xrealloc(E->glyphs, cap);
+    }
+
+    size_t x0 = x, to = ln->len - x < cols * 4 ? ln->len : x + cols * 4;
+    const size_t *hit = NULL;
+    size_t nhit = 0, h = 0;
+    if (E->find.active && E->find.len && !E->find.regex) nhit = editor_find_hits(E, ln, x, to, &hit);
+    bool colored = E->syntax.lang != SYNTAX_NONE;
+    if (colored) {
+        if (to - x0 > E->classcap) {
+            E->classcap = (to - x0) * 2;
+            E->classes = xrealloc(E->classes, E->classcap);
+        }
+        syntax_line(&E->syntax, &E->buf, filerow, x0, to, E->classes);
+    }
 
-        if (filerow >= E->nlines) {
-            addch('~');
-            continue;
+    size_t n = 0;
+    bool rev = false;
+    ScreenColor color = SCREEN_DEFAULT;
+    while (x < ln->len && col < right) {
+        while (h < nhit && hit[2 * h + 1] <= x) h++;
+        bool in = h < nhit && hit[2 * h] <= x;
+        ScreenColor c = colored ? syntax_colors[E->classes[x - x0]] : SCREEN_DEFAULT;
+        if (in != rev || c != color) {
+            editor_draw_glyphs(E, n);
+            n = 0;
+            if (in != rev) screen_reverse(in);
+            if (c != color) screen_color(c);
+            rev = in;
+            color = c;
+        }
+        size_t w, k, len = width_at(ln, x, col, &w, E->glyphs + n, &k);
+        if (E->wrap && width_fold(ln, x, cols, col, w) != col) break; // starts the next row
+        if (col < left || col + w > right) {
+            size_t from = col < left ? left : col, to = col + w < right ? col + w : right;
+            memset(E->glyphs + n, ' ', to - from);
+            k = to - from;
+        }
+        n += k;
+        col += w;
+        x += len;
+    }
+    editor_draw_glyphs(E, n);
+    if (rev) screen_reverse(false);
+    if (color != SCREEN_DEFAULT) screen_color(SCREEN_DEFAULT);
+}
+
+// The screen row, from the top of the document, of row sub of line y.
+static size_t editor_screen_row(const Editor *E, size_t y, size_t sub) {
+    return E->wrap ? wrap_row(&E->wraps, y) + sub : y;
+}
+
+void editor_refresh_screen(Editor *E) {
+    screen_size(&E->screen_rows, &E->screen_cols);
+    editor_size_widths(E);
+    if (E->wrap) wrap_resize(&E->wraps, &E->buf, (size_t)E->screen_cols);
+    size_t ccol = editor_scroll(E);
+
+    int text_rows = editor_text_rows(E);
+
+    // A resized screen or a horizontal scroll invalidates every row. A
+    // vertical scroll by less than a screen moves the rows still visible
+    // with the terminal's scroll region and only draws the ones exposed.
+    bool full = E->coloff != E->drawn_coloff || E->screen_rows != E->drawn_rows ||
+                E->screen_cols != E->drawn_cols;
+    size_t top = editor_screen_row(E, E->rowoff, E->rowsub);
+    size_t old = editor_screen_row(E, E->drawn_rowoff, E->drawn_rowsub);
+    int exposed_lo = 0, exposed_hi = 0; // screen rows a scroll left blank
+    if (!full && top != old) {
+        size_t k = top > old ? top - old : old - top;
+        if (k >= (size_t)text_rows) {
+            full = true;
+        } else if (top > old) {
+            screen_scroll(0, text_rows, (int)k);
+            exposed_lo = text_rows - (int)k;
+            exposed_hi = text_rows;
+        } else {
+            screen_scroll(0, text_rows, -(int)k);
+            exposed_hi = (int)k;
         }
+    }
+    if (full) {
+        E->damage_lo = E->rowoff;
+        E->damage_hi = SIZE_MAX;
+        E->msg_dirty = true;
+    }
 
-        Line *ln = &E->lines[filerow];
-        if (E->coloff < ln->len) {
-            size_t avail = (size_t)E->screen_cols;
-            size_t to_print = ln->len - E->coloff;
-            if (to_print > avail) to_print = avail;
-            // Print visible part
-            addnstr(ln->data + E->coloff, (int)to_print);
+    // draw damaged rows of the text area
+    E->frame_rows = 0;
+    size_t filerow = E->rowoff, sub = E->rowsub, cols = (size_t)E->screen_cols;
+    size_t nrows = E->wrap ? wrap_rows(&E->wraps, filerow) : 1;
+    for (int y = 0; y < text_rows; y++) {
+        bool damaged = (filerow >= E->damage_lo && filerow < E->damage_hi) || (y >= exposed_lo && y < exposed_hi);
+        // an edit above can change how an undamaged row is colored
+        if (damaged || syntax_stale(&E->syntax, &E->buf, filerow)) {
+            editor_draw_row(E, y, filerow, E->wrap ? sub * cols : E->coloff);
+            E->frame_rows++;
+        }
+        if (++sub == nrows) {
+            filerow++;
+            sub = 0;
+            if (E->wrap) nrows = wrap_rows(&E->wraps, filerow);
         }
     }
+    E->rows_drawn += (size_t)E->frame_rows;
+    E->damage_lo = E->damage_hi = 0;
+    E->drawn_rowoff = E->rowoff;
+    E->drawn_rowsub = E->rowsub;
+    E->drawn_coloff = E->coloff;
+    E->drawn_rows = E->screen_rows;
+    E->drawn_cols = E->screen_cols;
 
     // status bar
-    attron(A_REVERSE);
+    screen_reverse(true);
     char status[256];
     char rstatus[64];
     const char *name = E->filename ? E->filename : "[No Name]";
-    snprintf(status, sizeof(status), " %s%s", name, E->dirty ? " (modified)" : "");
-    snprintf(rstatus, sizeof(rstatus), " Ln %zu, Col %zu ", E->cy + 1, E->cx + 1);
+    int n = snprintf(status, sizeof(status), " %s%s", name, E->dirty ? " (modified)" : "");
+    if (buffer_loading(&E->buf) && n > 0 && (size_t)n < sizeof(status)) {
+        snprintf(status + n, sizeof(status) - (size_t)n, "  Loading %d%%", buffer_load_percent(&E->buf));
+    } else if (E->saving && n > 0 && (size_t)n < sizeof(status)) {
+        snprintf(status + n, sizeof(status) - (size_t)n, "  Saving %d%%", save_percent(E->saving));
+    }
+    size_t off = buffer_line_offset(&E->buf, E->cy) + E->cx;
+    snprintf(rstatus, sizeof(rstatus), " Ln %zu, Col %zu, Byte %zu ", E->cy + 1, ccol + 1, off);
 
     int y_status = E->screen_rows - 2;
-    move(y_status, 0);
-    clrtoeol();
-    addnstr(status, E->screen_cols);
+    screen_move(y_status, 0);
+    screen_clrtoeol();
+    screen_addnstr(status, E->screen_cols);
 
     // right-aligned rstatus
     int rlen = (int)strlen(rstatus);
     int col = E->screen_cols - rlen;
     if (col < 0) col = 0;
-    mvaddnstr(y_status, col, rstatus, E->screen_cols - col);
-    attroff(A_REVERSE);
+    screen_move(y_status, col);
+    screen_addnstr(rstatus, E->screen_cols - col);
+    screen_reverse(false);
 
     // message line
-    int y_msg = E->screen_rows - 1;
-    move(y_msg, 0);
-    clrtoeol();
-    if (E->msg[0]) addnstr(E->msg, E->screen_cols);
+    if (E->msg_dirty) {
+        screen_move(E->screen_rows - 1, 0);
+        screen_clrtoeol();
+        if (E->msg[0]) screen_addnstr(E->msg, E->screen_cols);
+        E->msg_dirty = false;
+    }
 
     // place cursor
-    int cx_screen = (int)(E->cx - E->coloff);
+    int cx_screen = (int)(ccol - E->coloff);
     int cy_screen = (int)(E->cy - E->rowoff);
+    if (E->wrap) {
+        cx_screen = (int)(ccol % cols);
+        cy_screen = (int)(wrap_row(&E->wraps, E->cy) + ccol / cols - top);
+    }
     if (cy_screen < 0) cy_screen = 0;
     if (cy_screen >= text_rows) cy_screen = text_rows - 1;
     if (cx_screen < 0) cx_screen = 0;
     if (cx_screen >= E->screen_cols) cx_screen = E->screen_cols - 1;
 
-    move(cy_screen, cx_screen);
-    refresh();
+    screen_move(cy_screen, cx_screen);
+    screen_refresh();
+}
+
+// Soft wrap on or off. Turning it on measures every line once, so the
+// rest of the file is loaded first.
+static void editor_toggle_wrap(Editor *E) {
+    E->wrap = !E->wrap;
+    E->rowsub = E->coloff = 0;
+    if (E->wrap) {
+        size_t nlines = buffer_nlines(&E->buf);
+        buffer_finish_load(&E->buf);
+        if (buffer_nlines(&E->buf) != nlines) editor_damage(E, nlines, SIZE_MAX);
+        wrap_build(&E->wraps, &E->buf, (size_t)E->screen_cols);
+    } else {
+        wrap_free(&E->wraps);
+    }
+    editor_damage(E, 0, SIZE_MAX);
+    editor_set_msg(E, "Soft wrap %s", E->wrap ? "on" : "off");
 }
 
 static bool editor_confirm_quit(Editor *E) {
     if (!E->dirty) return true;
     editor_set_msg(E, "Unsaved changes! Press Ctrl+Q again to quit, or Ctrl+S to save.");
     editor_refresh_screen(E);
-    int c = getch();
+    int c = screen_getch(-1);
     if (c == 17) return true; // Ctrl+Q
     if (c == 19) { editor_save(E); return false; } // Ctrl+S
     editor_set_msg(E, "");
     return false;
 }
 
+// Read a line of input on the message line. Returns false if Esc
+// cancels it.
+static bool editor_prompt(Editor *E, const char *prompt, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (;;) {
+        editor_set_msg(E, "%s%s", prompt, buf);
+        editor_refresh_screen(E);
+        int c = screen_getch(-1);
+        if (c == '\r' || c == '\n' || c == 27) {
+            editor_set_msg(E, "");
+            return c != 27;
+        }
+        if ((c == KEY_BACKSPACE || c == 127 || c == 8) && len) {
+            buf[--len] = '\0';
+        } else if (c < 0x100 && isprint(c) && len + 1 < size) {
+            buf[len++] = (char)c;
+            buf[len] = '\0';
+        }
+    }
+}
+
+// A decimal number, possibly grouped with ',' or '_' ("17,000,000").
+static bool editor_parse_count(const char **s, size_t *v) {
+    const char *p = *s;
+    size_t n = 0;
+    bool any = false;
+    for (; isdigit((unsigned char)*p) || ((*p == ',' || *p == '_') && any); p++) {
+        if (*p == ',' || *p == '_') continue;
+        size_t d = (size_t)(*p - '0');
+        if (n > (SIZE_MAX - d) / 10) return false;
+        n = n * 10 + d;
+        any = true;
+    }
+    *s = p;
+    *v = n;
+    return any;
+}
+
+// Go to a line ("1200", or "1200:8" with a column), a byte offset into the
+// file ("@1834212399") or a percentage of it ("50%"). The tree keeps line
+// and byte counts per subtree, so each is one O(log n) descent.
+static void editor_goto(Editor *E) {
+    char in[64];
+    if (!editor_prompt(E, "Go to line[:col], @byte or N%: ", in, sizeof(in))) return;
+
+    const char *p = in;
+    while (*p == ' ') p++;
+    bool byte = *p == '@';
+    if (byte) p++;
+    size_t v, col = 0;
+    bool ok = editor_parse_count(&p, &v);
+    bool percent = ok && !byte && *p == '%';
+    if (percent) {
+        p++;
+    } else if (ok && !byte && *p == ':') {
+        p++;
+        ok = editor_parse_count(&p, &col);
+    }
+    while (*p == ' ') p++;
+    if (!ok || *p || (percent && v > 100)) {
+        editor_set_msg(E, "Not a line, @byte or N%%: %s", in);
+        return;
+    }
+
+    // offsets and percentages are of the whole file
+    size_t nlines = buffer_nlines(&E->buf);
+    if (byte || percent || v > nlines) buffer_finish_load(&E->buf);
+    if (buffer_nlines(&E->buf) != nlines) editor_damage(E, nlines, SIZE_MAX);
+    nlines = buffer_nlines(&E->buf);
+
+    size_t y, x = 0;
+    if (byte || percent) {
+        size_t bytes = buffer_bytes(&E->buf);
+        size_t off = byte ? v : bytes / 100 * v + bytes % 100 * v / 100;
+        if (off >= bytes) off = bytes ? bytes - 1 : 0;
+        y = buffer_line_at_offset(&E->buf, off);
+        x = percent ? 0 : off - buffer_line_offset(&E->buf, y);
+    } else {
+        y = v ? v - 1 : 0;
+        if (y >= nlines) y = nlines - 1;
+    }
+    undo_seal(&E->undo);
+    if (byte || percent) {
+        size_t len = buffer_line(&E->buf, y)->len;
+        E->cy = y;
+        E->cx = x < len ? x : len;
+    } else {
+        editor_to_col(E, y, col ? col - 1 : 0);
+    }
+
+    // a jump off screen puts the line in the middle
+    size_t rows = (size_t)editor_text_rows(E);
+    if (E->cy < E->rowoff || E->cy >= E->rowoff + rows) {
+        E->rowoff = E->cy - (E->cy < rows / 2 ? E->cy : rows / 2);
+        E->rowsub = 0;
+    }
+}
+
 void editor_process_key(Editor *E, int c) {
+    if (E->find.active && editor_find_key(E, c)) return;
+
     // Ctrl keys: c & 0x1f
     if (c == 17) { // Ctrl+Q
+        if (E->saving) {
+            editor_set_msg(E, "Finishing save...");
+            editor_refresh_screen(E);
+            editor_save_poll(E, true);
+        }
         if (editor_confirm_quit(E)) {
-            endwin();
+            if (E->journal) journal_close(E->journal);
+            screen_end();
             exit(0);
         }
         return;
@@ -220,6 +765,30 @@ void editor_process_key(Editor *E, int c) {
         editor_save(E);
         return;
     }
+    if (c == 6 || c == 18) { // Ctrl+F, Ctrl+R
+        editor_find(E, c == 18);
+        return;
+    }
+    if (c == 7) { // Ctrl+G
+        editor_goto(E);
+        return;
+    }
+    if (c == 14 || c == 16) { // Ctrl+N, Ctrl+P
+        editor_match_step(E, c == 16);
+        return;
+    }
+    if (c == 23) { // Ctrl+W
+        editor_toggle_wrap(E);
+        return;
+    }
+    if (c == 26) { // Ctrl+Z
+        editor_undo(E);
+        return;
+    }
+    if (c == 25) { // Ctrl+Y
+        editor_redo(E);
+        return;
+    }
 
     switch (c) {
         case KEY_UP:
@@ -244,31 +813,67 @@ void editor_process_key(Editor *E, int c) {
         case '\n':
             editor_insert_newline(E);
             break;
+        case SCREEN_PASTE:
+            editor_paste(E);
+            break;
         case KEY_RESIZE:
-            // handled in refresh by getmaxyx()
+            // handled in refresh by screen_size()
             break;
         default:
-            if (isprint(c) || c == '\t') {
+            // bytes of UTF-8 text come one at a time
+            if (isprint(c) || c == '\t' || (c >= 0x80 && c < 0x100)) {
                 editor_insert_char(E, c);
             }
             break;
     }
 }
 
+// Background work between key presses. Returns how long the caller may
+// wait for a key before calling again: not at all while a search has
+// slices left, a little while a file is loading or saving, and otherwise
+// as long as it likes (-1).
+int editor_poll(Editor *E) {
+    size_t nlines = buffer_nlines(&E->buf);
+    bool loading = buffer_poll(&E->buf);
+    if (buffer_nlines(&E->buf) != nlines) editor_damage(E, nlines, SIZE_MAX);
+    bool saving = editor_save_poll(E, false);
+    bool logging = E->journal && journal_tick(E->journal);
+    if (editor_find_poll(E)) return 0;
+    return loading || saving || logging ? 50 : -1;
+}
+
 void editor_init(Editor *E, const char *filename) {
     memset(E, 0, sizeof(*E));
     E->filename = filename ? xstrdup(filename) : NULL;
-    E->lines = NULL;
-    E->nlines = 0;
-    E->cap = 0;
-    editor_insert_line(E, 0, line_new_from("", 0));
-    editor_set_msg(E, "Ctrl+S save | Ctrl+Q quit");
-
-    if (E->filename) editor_load_file(E, E->filename);
+    buffer_init(&E->buf);
+    undo_init(&E->undo, EDITOR_UNDO_LIMIT);
+    editor_size_widths(E);
+    syntax_init(&E->syntax, syntax_lang(filename));
+    wrap_init(&E->wraps);
+    editor_set_msg(E, "Ctrl+S save | Ctrl+Q quit | Ctrl+F find | Ctrl+Z undo | Ctrl+Y redo");
+
+    if (E->filename) {
+        editor_load_file(E, E->filename);
+        size_t n;
+        E->journal = journal_open(E->filename, &E->buf, &n);
+        if (n) {
+            E->dirty = true;
+            editor_set_msg(E, "Recovered %zu edits from an unclean exit", n);
+        }
+    }
 }
 
 void editor_free(Editor *E) {
-    for (size_t i = 0; i < E->nlines; i++) line_free(&E->lines[i]);
-    free(E->lines);
+    editor_save_poll(E, true);
+    if (E->journal) journal_close(E->journal);
+    buffer_free(&E->buf);
+    undo_free(&E->undo);
+    editor_find_free(E);
+    for (size_t i = 0; i < E->nwidths; i++) width_free(&E->widths[i]);
+    free(E->widths);
+    free(E->glyphs);
+    syntax_free(&E->syntax);
+    wrap_free(&E->wraps);
+    free(E->classes);
     free(E->filename);
 }
@@ -4,20 +4,76 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-#include "line.h"
+#include "buffer.h"
+#include "grep.h"
+#include "syntax.h"
+#include "undo.h"
+#include "width.h"
+#include "wrap.h"
+
+typedef struct Journal Journal;
+typedef struct SaveJob SaveJob;
+
+// Incremental search (Ctrl+F). While the prompt is open each change to
+// the query starts a scan from where the cursor was when it opened; the
+// scan runs in slices between key presses and wraps around at the end.
+// The same prompt takes a regular expression for Ctrl+R, which is only
+// run once it is complete, and optionally text to replace its matches.
+typedef struct {
+    bool active;        // prompt open
+    bool regex;         // for Ctrl+R
+    bool replacing;     // typing the replacement of a regex
+    char with[128];
+    size_t wlen;
+    char query[128];
+    size_t len;
+    size_t oy, ox;      // cursor when the prompt opened
+    bool scanning;      // a scan is under way
+    size_t sy;          // line the scan started on
+    size_t ny, nx;      // where it goes on
+    bool wrapped;
+    char *row;          // copy of the bytes around a row being drawn
+    size_t rowcap;
+    size_t *hits;       // matches on that row, as byte ranges
+    size_t nhits, hitcap;
+} Search;
+
+// Column maps kept at least, before the screen size is known.
+#define EDITOR_WIDTHS 4
 
 typedef struct {
-    Line  *lines;
-    size_t nlines;
-    size_t cap;
+    Buffer buf;
+    Undo undo;
+    Search find;
+    // matches of the last regex search, in document order, for Ctrl+N
+    // and Ctrl+P to step through
+    GrepMatch *matches;
+    size_t nmatches;
 
     // cursor position (in document coordinates)
     size_t cy; // line index
-    size_t cx; // column within line (0..len)
+    size_t cx; // byte within line (0..len)
 
     // viewport (top-left) in document coordinates
     size_t rowoff; // first visible line
-    size_t coloff; // first visible column
+    size_t coloff; // first visible display column
+
+    // soft wrap (Ctrl+W): the view starts at row rowsub of line rowoff,
+    // and coloff stays 0
+    bool wrap;
+    WrapTree wraps;
+    size_t rowsub;
+
+    // byte offset to display column, for the lines last drawn or moved
+    // through: one per screen row and one more, so a redraw keeps them all
+    WidthMap *widths;
+    size_t nwidths;
+    unsigned long width_tick;
+    char *glyphs; // what a row being drawn shows
+    size_t glyphcap;
+    Syntax syntax;
+    unsigned char *classes; // syntax classes of the bytes of that row
+    size_t classcap;
 
     // screen size
     int screen_rows; // includes status/message line; we render text into screen_rows-2
@@ -26,14 +82,31 @@ typedef struct {
     // file + state
     char *filename;
     bool dirty;
+    size_t changes;       // edits so far
+    SaveJob *saving;      // background save in progress, or NULL
+    size_t save_changes;  // changes when the running save started
+    size_t save_mark;     // journal position when the running save started
+    Journal *journal;     // edit log for crash recovery, or NULL
+    bool no_mmap; // load with read() even when the file could be mapped
 
     // message line
     char msg[256];
+    bool msg_dirty; // changed since drawn
+
+    // Rendering: the viewport of the last frame, and the document lines
+    // [damage_lo, damage_hi) that changed since. Only damaged rows are
+    // redrawn unless the viewport moved.
+    size_t drawn_rowoff, drawn_rowsub, drawn_coloff;
+    int drawn_rows, drawn_cols; // 0 before the first frame
+    size_t damage_lo, damage_hi;
+    int frame_rows;    // text rows redrawn by the last refresh
+    size_t rows_drawn; // text rows redrawn by all refreshes
 } Editor;
 
 void editor_init(Editor *E, const char *filename);
 void editor_free(Editor *E);
 void editor_refresh_screen(Editor *E);
 void editor_process_key(Editor *E, int c);
+int editor_poll(Editor *E);
 
 #endif
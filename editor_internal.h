@@ -7,9 +7,17 @@
 void editor_set_msg(Editor *E, const char *fmt, ...);
 void editor_load_file(Editor *E, const char *path);
 bool editor_save(Editor *E);
+bool editor_save_poll(Editor *E, bool wait);
+void editor_damage(Editor *E, size_t lo, size_t hi);
+void editor_replace_spans(Editor *E, const BufferEdit *e, size_t n);
 
-void editor_ensure_lines(Editor *E, size_t need);
-void editor_insert_line(Editor *E, size_t at, Line ln);
-void editor_delete_line(Editor *E, size_t at);
+void editor_find(Editor *E, bool regex);
+bool editor_find_key(Editor *E, int c);
+bool editor_find_poll(Editor *E);
+// Matches of the search query overlapping bytes [from, to) of ln, as
+// pairs of byte offsets in *hit. Returns how many.
+size_t editor_find_hits(Editor *E, const Line *ln, size_t from, size_t to, const size_t **hit);
+void editor_find_free(Editor *E);
+void editor_match_step(Editor *E, bool back);
 
 #endif
@@ -2,17 +2,57 @@
 #include "editor_internal.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "save.h"
+
+// Mapped files at least this large are indexed in the background.
+#define LOAD_ASYNC_MIN (8u << 20)
 
 void editor_set_msg(Editor *E, const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
     vsnprintf(E->msg, sizeof(E->msg), fmt, ap);
     va_end(ap);
+    E->msg_dirty = true;
+}
+
+// Read the whole stream into one buffer; it becomes the document's
+// read-only original text.
+static char *read_all(FILE *f, size_t *lenp) {
+    size_t cap = 65536, len = 0;
+    char *buf = xmalloc(cap);
+    size_t n;
+    while ((n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            buf = xrealloc(buf, cap);
+        }
+    }
+    *lenp = len;
+    return buf;
+}
+
+// Map a regular file read-only. Lines stay views into the mapping until
+// they are edited, so untouched text never reaches the heap. Returns NULL
+// for pipes, devices and empty files, which go through read_all().
+static char *map_file(FILE *f, size_t *lenp) {
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return NULL;
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED) return NULL;
+    *lenp = (size_t)st.st_size;
+    return p;
 }
 
 void editor_load_file(Editor *E, const char *path) {
@@ -23,23 +63,19 @@ void editor_load_file(Editor *E, const char *path) {
         return;
     }
 
-    // Clear existing
-    for (size_t i = 0; i < E->nlines; i++) line_free(&E->lines[i]);
-    E->nlines = 0;
-
-    char *line = NULL;
-    size_t cap = 0;
-    ssize_t n;
-    while ((n = getline(&line, &cap, f)) != -1) {
-        // Strip trailing \n / \r\n
-        size_t len = (size_t)n;
-        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
-        editor_insert_line(E, E->nlines, line_new_from(line, len));
+    size_t len;
+    char *data = E->no_mmap ? NULL : map_file(f, &len);
+    if (data && len >= LOAD_ASYNC_MIN) {
+        buffer_load_async(&E->buf, data, len, true);
+    } else if (data) {
+        buffer_load(&E->buf, data, len, true);
+    } else {
+        data = read_all(f, &len);
+        buffer_load(&E->buf, data, len, false);
     }
-    free(line);
+    buffer_set_source(&E->buf, fileno(f));
     fclose(f);
 
-    if (E->nlines == 0) editor_insert_line(E, 0, line_new_from("", 0));
     E->dirty = false;
     editor_set_msg(E, "Opened: %s", path);
 }
@@ -49,52 +85,39 @@ bool editor_save(Editor *E) {
         editor_set_msg(E, "No filename. Run as: ./miedit file.txt");
         return false;
     }
-
-    // Write to temp then rename (best effort).
-    size_t tmpsz = strlen(E->filename) + 16;
-    char *tmp = xmalloc(tmpsz);
-    snprintf(tmp, tmpsz, "%s.tmp", E->filename);
-
-    FILE *f = fopen(tmp, "wb");
-    if (!f) {
-        editor_set_msg(E, "Save failed: %s", strerror(errno));
-        free(tmp);
+    if (buffer_loading(&E->buf)) {
+        editor_set_msg(E, "Still loading: save when loading finishes");
         return false;
     }
-
-    for (size_t i = 0; i < E->nlines; i++) {
-        if (E->lines[i].len && fwrite(E->lines[i].data, 1, E->lines[i].len, f) != E->lines[i].len) {
-            editor_set_msg(E, "Write failed");
-            fclose(f);
-            remove(tmp);
-            free(tmp);
-            return false;
-        }
-        if (fputc('\n', f) == EOF) {
-            editor_set_msg(E, "Write failed");
-            fclose(f);
-            remove(tmp);
-            free(tmp);
-            return false;
-        }
-    }
-
-    if (fclose(f) != 0) {
-        editor_set_msg(E, "Close failed: %s", strerror(errno));
-        remove(tmp);
-        free(tmp);
+    if (E->saving) {
+        editor_set_msg(E, "Already saving");
         return false;
     }
 
-    if (rename(tmp, E->filename) != 0) {
-        editor_set_msg(E, "Rename failed: %s", strerror(errno));
-        remove(tmp);
-        free(tmp);
+    // The worker writes a snapshot; editing can go on meanwhile.
+    E->saving = save_start(&E->buf, E->filename, true);
+    E->save_changes = E->changes;
+    if (E->journal) E->save_mark = journal_mark(E->journal);
+    editor_set_msg(E, "Saving: %s", E->filename);
+    editor_save_poll(E, false);
+    return true;
+}
+
+// Collect a finished background save; with wait set, block until it is
+// done. Returns true while a save is still running.
+bool editor_save_poll(Editor *E, bool wait) {
+    if (!E->saving) return false;
+    if (!wait && save_poll(E->saving)) return true;
+
+    int err = save_finish(E->saving);
+    E->saving = NULL;
+    if (err) {
+        editor_set_msg(E, "Save failed: %s", strerror(err));
         return false;
     }
-
-    free(tmp);
-    E->dirty = false;
+    // Edits made during the save are not in the file.
+    E->dirty = E->changes != E->save_changes;
+    if (E->journal) journal_rebase(E->journal, E->save_mark);
     editor_set_msg(E, "Saved: %s", E->filename);
-    return true;
+    return false;
 }
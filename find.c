@@ -0,0 +1,74 @@
+#include "find.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIND_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*FindFn)(const char *p, size_t n, const char *s, size_t m);
+
+static const char *find_scalar(const char *p, size_t n, const char *s, size_t m) {
+    const char *end = p + n - m + 1;
+    while (p < end) {
+        p = memchr(p, s[0], (size_t)(end - p));
+        if (!p) return NULL;
+        if (memcmp(p + 1, s + 1, m - 1) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+#ifdef FIND_X86
+static const char *find_sse2(const char *p, size_t n, const char *s, size_t m) {
+    const __m128i first = _mm_set1_epi8(s[0]);
+    const __m128i last = _mm_set1_epi8(s[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + m - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t k = i + (size_t)__builtin_ctz(mask);
+            if (memcmp(p + k + 1, s + 1, m - 2) == 0) return p + k;
+            mask &= mask - 1;
+        }
+    }
+    return i + m <= n ? find_scalar(p + i, n - i, s, m) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, size_t n, const char *s, size_t m) {
+    const __m256i first = _mm256_set1_epi8(s[0]);
+    const __m256i last = _mm256_set1_epi8(s[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + m - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t k = i + (size_t)__builtin_ctz(mask);
+            if (memcmp(p + k + 1, s + 1, m - 2) == 0) return p + k;
+            mask &= mask - 1;
+        }
+    }
+    return i + m <= n ? find_sse2(p + i, n - i, s, m) : NULL;
+}
+#endif
+
+static FindFn find_kernel(void) {
+#ifdef FIND_X86
+    if (__builtin_cpu_supports("avx2")) return find_avx2;
+    if (__builtin_cpu_supports("sse2")) return find_sse2;
+#endif
+    return find_scalar;
+}
+
+const char *find_mem(const char *p, size_t n, const char *s, size_t m) {
+    if (!m) return p;
+    if (m > n) return NULL;
+    if (m == 1) return memchr(p, s[0], n);
+    return find_kernel()(p, n, s, m);
+}
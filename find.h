@@ -0,0 +1,11 @@
+#ifndef FIND_H
+#define FIND_H
+
+#include <stddef.h>
+
+// First occurrence of s (m bytes) in p[0..n), or NULL. Candidates are
+// picked 16 or 32 positions at a time by comparing the first and last
+// byte of s with SIMD, and only those are checked with memcmp.
+const char *find_mem(const char *p, size_t n, const char *s, size_t m);
+
+#endif
@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+#include "grep.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Documents smaller than this are searched on the calling thread alone.
+#define GREP_SPLIT_MIN   (1u << 20)
+#define GREP_THREADS_MAX 16
+
+// The lines [lo, hi) and what one thread found in them.
+typedef struct {
+    Buffer *B;
+    const char *pat;
+    int cflags;
+    size_t lo, hi;
+    bool list;
+    GrepMatch *m;
+    size_t n, cap;
+    char *row; // copy of the current line, where one is needed
+    size_t rowcap;
+} GrepPart;
+
+static void part_add(GrepPart *g, size_t y, size_t x, size_t n) {
+    if (g->list) {
+        if (g->n == g->cap) {
+            g->cap = g->cap ? g->cap * 2 : 256;
+            g->m = xrealloc(g->m, g->cap * sizeof(GrepMatch));
+        }
+        g->m[g->n] = (GrepMatch){ y, x, n };
+    }
+    g->n++;
+}
+
+// The text of ln for regexec(). With REG_STARTEND the bytes need no
+// terminator and most lines are searched where they lie.
+static const char *part_text(GrepPart *g, const Line *ln) {
+#ifdef REG_STARTEND
+    if (!ln->gaplen) return ln->data ? ln->data : "";
+#endif
+    if (ln->len + 1 > g->rowcap) {
+        g->rowcap = (ln->len + 1) * 2;
+        g->row = xrealloc(g->row, g->rowcap);
+    }
+    for (size_t x = 0, k; x < ln->len; x += k) {
+        const char *p = line_peek(ln, x, &k);
+        memcpy(g->row + x, p, k);
+    }
+    g->row[ln->len] = '\0';
+    return g->row;
+}
+
+static void part_line(GrepPart *g, const regex_t *re, size_t y, const Line *ln) {
+    const char *p = part_text(g, ln);
+    regmatch_t m;
+    int flags = 0;
+    for (size_t x = 0; x <= ln->len; flags = REG_NOTBOL) {
+#ifdef REG_STARTEND
+        m.rm_so = (regoff_t)x;
+        m.rm_eo = (regoff_t)ln->len;
+        if (regexec(re, p, 1, &m, flags | REG_STARTEND) != 0) break;
+#else
+        if (regexec(re, p + x, 1, &m, flags) != 0) break;
+        m.rm_so += (regoff_t)x;
+        m.rm_eo += (regoff_t)x;
+#endif
+        part_add(g, y, (size_t)m.rm_so, (size_t)(m.rm_eo - m.rm_so));
+        // on after the match, or a byte on after an empty one
+        x = (size_t)(m.rm_eo > m.rm_so ? m.rm_eo : m.rm_so + 1);
+    }
+}
+
+static void *part_main(void *arg) {
+    GrepPart *g = arg;
+    regex_t re;
+    if (regcomp(&re, g->pat, g->cflags) != 0) return NULL;
+    LtIter it;
+    buffer_iter(g->B, g->lo, &it);
+    for (size_t y = g->lo; y < g->hi; y++) part_line(g, &re, y, buffer_iter_next(&it));
+    regfree(&re);
+    free(g->row);
+    g->row = NULL;
+    return NULL;
+}
+
+size_t grep_buffer(Buffer *B, const char *pat, int cflags, GrepMatch **list) {
+    size_t nlines = buffer_nlines(B), bytes = buffer_bytes(B);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nt = bytes < GREP_SPLIT_MIN || cpus < 1 ? 1 : (size_t)cpus;
+    if (nt > GREP_THREADS_MAX) nt = GREP_THREADS_MAX;
+
+    // ranges of about bytes / nt each, cut at line starts
+    GrepPart part[GREP_THREADS_MAX];
+    size_t lo = 0;
+    for (size_t i = 0; i < nt; i++) {
+        size_t hi = i + 1 == nt ? nlines : buffer_line_at_offset(B, bytes / nt * (i + 1));
+        if (hi < lo) hi = lo;
+        part[i] = (GrepPart){ .B = B, .pat = pat, .cflags = cflags, .lo = lo, .hi = hi, .list = list != NULL };
+        lo = hi;
+    }
+
+    // The calling thread takes the first range, and any range whose
+    // thread could not be started.
+    pthread_t tid[GREP_THREADS_MAX];
+    bool started[GREP_THREADS_MAX] = { false };
+    for (size_t i = 1; i < nt; i++) started[i] = pthread_create(&tid[i], NULL, part_main, &part[i]) == 0;
+    part_main(&part[0]);
+    for (size_t i = 1; i < nt; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+        else part_main(&part[i]);
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < nt; i++) total += part[i].n;
+    if (!list) return total;
+    if (nt == 1) {
+        *list = part[0].m;
+        return total;
+    }
+    GrepMatch *m = total ? xmalloc(total * sizeof(GrepMatch)) : NULL;
+    for (size_t i = 0, at = 0; i < nt; i++) {
+        if (part[i].n) memcpy(m + at, part[i].m, part[i].n * sizeof(GrepMatch));
+        at += part[i].n;
+        free(part[i].m);
+    }
+    *list = m;
+    return total;
+}
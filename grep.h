@@ -0,0 +1,24 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <regex.h>
+#include <stddef.h>
+
+#include "buffer.h"
+
+// One match of a regular expression: n bytes from column x of line y.
+typedef struct {
+    size_t y, x, n;
+} GrepMatch;
+
+// Search every line of B for the POSIX regular expression pat (compiled
+// with cflags), on up to one thread per CPU, each taking a range of lines
+// of about equal size. Returns the number of matches; with list set, the
+// matches are also returned in *list in document order (free() it).
+//
+// Each thread compiles pat for itself, since a regex_t may serialize
+// the threads that share it. The caller checks that pat compiles. The
+// document must not change during the call.
+size_t grep_buffer(Buffer *B, const char *pat, int cflags, GrepMatch **list);
+
+#endif
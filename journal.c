@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define JOURNAL_MAGIC       "MZJ1"
+#define JOURNAL_SYNC_MS     1000
+#define JOURNAL_PENDING_MAX (64u << 10)
+
+// The file a journal applies to: records replay over exactly this version.
+typedef struct {
+    uint64_t ino;
+    uint64_t size;
+    int64_t  sec;
+    int64_t  nsec;
+} JournalId;
+
+#define JOURNAL_HDR (4 + sizeof(JournalId))
+#define JOURNAL_REC 18 // op, ch, y (8 bytes), x (8 bytes)
+#define JOURNAL_TEXT_HDR (JOURNAL_REC + 8) // then the length (8 bytes) and text
+#define JOURNAL_ERASE_REC (JOURNAL_REC + 16) // then the end y and x
+#define JOURNAL_SPAN 32 // y, x, n and slen of a span (8 bytes each), then its text
+
+struct Journal {
+    char *path; // the journal itself
+    char *file; // the file it belongs to
+    int fd;     // -1 until the first record is written
+    bool failed;
+    JournalId id;
+
+    size_t logged; // record bytes in the journal file
+    char *pending; // records not yet written
+    size_t npending, cap;
+    double due;    // when pending records must be written
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// .NAME.mzj in the directory of path.
+static char *journal_path(const char *path) {
+    const char *slash = strrchr(path, '/');
+    size_t dirlen = slash ? (size_t)(slash - path) + 1 : 0;
+    size_t n = strlen(path) + 8;
+    char *j = xmalloc(n);
+    snprintf(j, n, "%.*s.%s.mzj", (int)dirlen, path, path + dirlen);
+    return j;
+}
+
+// A file that does not exist has the all-zero id.
+static JournalId file_id(const char *path) {
+    JournalId id = {0};
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        id.ino = (uint64_t)st.st_ino;
+        id.size = (uint64_t)st.st_size;
+        id.sec = (int64_t)st.st_mtim.tv_sec;
+        id.nsec = (int64_t)st.st_mtim.tv_nsec;
+    }
+    return id;
+}
+
+static bool write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static bool write_header(Journal *J) {
+    char hdr[JOURNAL_HDR];
+    memcpy(hdr, JOURNAL_MAGIC, 4);
+    memcpy(hdr + 4, &J->id, sizeof(J->id));
+    return write_all(J->fd, hdr, sizeof(hdr));
+}
+
+// Stop journaling after an I/O error rather than failing every edit.
+static void journal_fail(Journal *J) {
+    J->failed = true;
+    J->npending = 0;
+}
+
+static void journal_flush(Journal *J) {
+    if (J->failed || !J->npending) return;
+    if (J->fd < 0) {
+        J->fd = open(J->path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+        if (J->fd < 0 || !write_header(J)) {
+            journal_fail(J);
+            return;
+        }
+    }
+    if (!write_all(J->fd, J->pending, J->npending) || fdatasync(J->fd) != 0) {
+        journal_fail(J);
+        return;
+    }
+    J->logged += J->npending;
+    J->npending = 0;
+}
+
+// Size of the record at r, or 0 if it runs past the n bytes available.
+static size_t record_len(const unsigned char *r, size_t n) {
+    if (n < JOURNAL_REC) return 0;
+    if (r[0] == JOURNAL_ERASE) return n < JOURNAL_ERASE_REC ? 0 : JOURNAL_ERASE_REC;
+    if (r[0] != JOURNAL_TEXT && r[0] != JOURNAL_SPANS) return JOURNAL_REC;
+    uint64_t len;
+    if (n < JOURNAL_TEXT_HDR) return 0;
+    memcpy(&len, r + JOURNAL_REC, 8);
+    return len <= n - JOURNAL_TEXT_HDR ? JOURNAL_TEXT_HDR + (size_t)len : 0;
+}
+
+// Apply the spans in p[0..n) if they fit the document: in order, apart,
+// and each within its line.
+static bool replay_spans(Buffer *B, const unsigned char *p, size_t n) {
+    size_t count = 0;
+    for (size_t at = 0; at < n; count++) {
+        uint64_t slen;
+        if (n - at < JOURNAL_SPAN) return false;
+        memcpy(&slen, p + at + 24, 8);
+        if (slen > n - at - JOURNAL_SPAN) return false;
+        at += JOURNAL_SPAN + (size_t)slen;
+    }
+    BufferEdit *e = xmalloc((count ? count : 1) * sizeof(BufferEdit));
+    size_t ny = buffer_nlines(B), py = 0, pend = 0;
+    const unsigned char *q = p;
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        uint64_t v[4];
+        memcpy(v, q, sizeof(v));
+        e[i] = (BufferEdit){ (size_t)v[0], (size_t)v[1], (size_t)v[2], (const char *)q + JOURNAL_SPAN, (size_t)v[3] };
+        q += JOURNAL_SPAN + e[i].slen;
+        const Line *ln = e[i].y < ny ? buffer_line(B, e[i].y) : NULL;
+        ok = ln && e[i].x <= ln->len && e[i].n <= ln->len - e[i].x && !memchr(e[i].s, '\n', e[i].slen) &&
+             (i == 0 || e[i].y > py || (e[i].y == py && e[i].x >= pend));
+        py = e[i].y;
+        pend = e[i].x + e[i].n;
+    }
+    if (ok) buffer_replace_spans(B, e, count);
+    free(e);
+    return ok;
+}
+
+// Apply one record; false if it does not fit the document.
+static bool replay_one(Buffer *B, const unsigned char *r) {
+    uint64_t y, x;
+    memcpy(&y, r + 2, 8);
+    memcpy(&x, r + 10, 8);
+    if (y >= buffer_nlines(B)) return false;
+    size_t len = buffer_line(B, y)->len;
+    switch (r[0]) {
+    case JOURNAL_INSERT:
+        if (x > len) return false;
+        buffer_insert_char(B, y, x, r[1]);
+        return true;
+    case JOURNAL_DELETE:
+        if (x >= len) return false;
+        buffer_delete_char(B, y, x);
+        return true;
+    case JOURNAL_SPLIT:
+        if (x > len) return false;
+        buffer_split_line(B, y, x);
+        return true;
+    case JOURNAL_JOIN:
+        if (y + 1 >= buffer_nlines(B)) return false;
+        buffer_join_lines(B, y);
+        return true;
+    case JOURNAL_TEXT: {
+        if (x > len) return false;
+        uint64_t n;
+        size_t ey, ex;
+        memcpy(&n, r + JOURNAL_REC, 8);
+        buffer_insert_text(B, y, x, (const char *)r + JOURNAL_TEXT_HDR, (size_t)n, &ey, &ex);
+        return true;
+    }
+    case JOURNAL_ERASE: {
+        uint64_t y1, x1;
+        memcpy(&y1, r + JOURNAL_REC, 8);
+        memcpy(&x1, r + JOURNAL_REC + 8, 8);
+        if (x > len || y1 < y || y1 >= buffer_nlines(B) || x1 > buffer_line(B, y1)->len) return false;
+        buffer_delete_range(B, y, x, y1, x1);
+        return true;
+    }
+    case JOURNAL_SPANS: {
+        uint64_t n;
+        memcpy(&n, r + JOURNAL_REC, 8);
+        return replay_spans(B, r + JOURNAL_TEXT_HDR, (size_t)n);
+    }
+    }
+    return false;
+}
+
+// Replay the journal in fd over B. Returns the number of records applied,
+// or -1 if the journal is not for this version of the file; *used is set
+// to the size of those records.
+static long replay(Journal *J, int fd, Buffer *B, size_t *used) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < JOURNAL_HDR) return -1;
+    size_t size = (size_t)st.st_size;
+    unsigned char *data = xmalloc(size);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, data + got, size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+
+    JournalId id;
+    memcpy(&id, data + 4, sizeof(id));
+    if (got < JOURNAL_HDR || memcmp(data, JOURNAL_MAGIC, 4) != 0 || memcmp(&id, &J->id, sizeof(id)) != 0) {
+        free(data);
+        return -1;
+    }
+
+    // A record cut short by the crash ends the journal.
+    buffer_finish_load(B);
+    long n = 0;
+    size_t off = JOURNAL_HDR, len;
+    while ((len = record_len(data + off, got - off)) && replay_one(B, data + off)) {
+        off += len;
+        n++;
+    }
+    free(data);
+    *used = off - JOURNAL_HDR;
+    return n;
+}
+
+Journal *journal_open(const char *path, Buffer *B, size_t *recovered) {
+    Journal *J = xmalloc(sizeof(*J));
+    memset(J, 0, sizeof(*J));
+    J->path = journal_path(path);
+    J->file = xstrdup(path);
+    J->fd = -1;
+    J->id = file_id(path);
+    J->cap = JOURNAL_PENDING_MAX;
+    J->pending = xmalloc(J->cap);
+    *recovered = 0;
+
+    int fd = open(J->path, O_RDWR | O_APPEND);
+    if (fd < 0) return J;
+    size_t used;
+    long n = replay(J, fd, B, &used);
+    if (n < 0) {
+        close(fd);
+        size_t sz = strlen(J->path) + 8;
+        char *stale = xmalloc(sz);
+        snprintf(stale, sz, "%s.stale", J->path);
+        rename(J->path, stale);
+        free(stale);
+        return J;
+    }
+    // Keep appending after the records that applied.
+    J->fd = fd;
+    J->logged = used;
+    if (ftruncate(fd, (off_t)(JOURNAL_HDR + J->logged)) != 0) journal_fail(J);
+    *recovered = (size_t)n;
+    return J;
+}
+
+// A clean exit: the journal is no longer needed.
+void journal_close(Journal *J) {
+    if (J->fd >= 0) {
+        close(J->fd);
+        unlink(J->path);
+    }
+    free(J->pending);
+    free(J->path);
+    free(J->file);
+    free(J);
+}
+
+// Queue a record of size bytes and fill in its fixed part. A record larger
+// than the pending limit grows the buffer rather than being split.
+static unsigned char *journal_record(Journal *J, JournalOp op, size_t y, size_t x, int ch, size_t size) {
+    if (J->npending && J->npending + size > JOURNAL_PENDING_MAX) journal_flush(J);
+    if (J->npending + size > J->cap) {
+        J->cap = J->npending + size;
+        J->pending = xrealloc(J->pending, J->cap);
+    }
+    if (!J->npending) J->due = now_ms() + JOURNAL_SYNC_MS;
+
+    unsigned char *r = (unsigned char *)J->pending + J->npending;
+    uint64_t y64 = y, x64 = x;
+    r[0] = (unsigned char)op;
+    r[1] = (unsigned char)ch;
+    memcpy(r + 2, &y64, 8);
+    memcpy(r + 10, &x64, 8);
+    J->npending += size;
+    return r;
+}
+
+void journal_log(Journal *J, JournalOp op, size_t y, size_t x, int ch) {
+    if (J->failed) return;
+    journal_record(J, op, y, x, ch, JOURNAL_REC);
+}
+
+void journal_log_text(Journal *J, size_t y, size_t x, const char *s, size_t n) {
+    if (J->failed) return;
+    unsigned char *r = journal_record(J, JOURNAL_TEXT, y, x, 0, JOURNAL_TEXT_HDR + n);
+    uint64_t n64 = n;
+    memcpy(r + JOURNAL_REC, &n64, 8);
+    memcpy(r + JOURNAL_TEXT_HDR, s, n);
+}
+
+void journal_log_erase(Journal *J, size_t y0, size_t x0, size_t y1, size_t x1) {
+    if (J->failed) return;
+    unsigned char *r = journal_record(J, JOURNAL_ERASE, y0, x0, 0, JOURNAL_ERASE_REC);
+    uint64_t y64 = y1, x64 = x1;
+    memcpy(r + JOURNAL_REC, &y64, 8);
+    memcpy(r + JOURNAL_REC + 8, &x64, 8);
+}
+
+void journal_log_spans(Journal *J, const BufferEdit *e, size_t n) {
+    if (J->failed || !n) return;
+    size_t body = 0;
+    for (size_t i = 0; i < n; i++) body += JOURNAL_SPAN + e[i].slen;
+    unsigned char *r = journal_record(J, JOURNAL_SPANS, e[0].y, e[0].x, 0, JOURNAL_TEXT_HDR + body);
+    uint64_t n64 = body;
+    memcpy(r + JOURNAL_REC, &n64, 8);
+    unsigned char *q = r + JOURNAL_TEXT_HDR;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v[4] = { e[i].y, e[i].x, e[i].n, e[i].slen };
+        memcpy(q, v, sizeof(v));
+        if (e[i].slen) memcpy(q + JOURNAL_SPAN, e[i].s, e[i].slen);
+        q += JOURNAL_SPAN + e[i].slen;
+    }
+}
+
+bool journal_tick(Journal *J) {
+    if (J->npending && now_ms() >= J->due) journal_flush(J);
+    return J->npending != 0;
+}
+
+size_t journal_mark(Journal *J) {
+    return J->logged + J->npending;
+}
+
+void journal_rebase(Journal *J, size_t mark) {
+    journal_flush(J);
+    J->id = file_id(J->file);
+    if (J->failed || J->fd < 0) return;
+
+    // Records after the mark were logged while the save ran.
+    size_t keep = J->logged > mark ? J->logged - mark : 0;
+    char *tail = xmalloc(keep);
+    size_t got = 0;
+    while (got < keep) {
+        ssize_t n = pread(J->fd, tail + got, keep - got, (off_t)(JOURNAL_HDR + mark + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    if (got < keep || ftruncate(J->fd, 0) != 0 || !write_header(J) || !write_all(J->fd, tail, keep) ||
+        fdatasync(J->fd) != 0) {
+        journal_fail(J);
+    }
+    J->logged = keep;
+    free(tail);
+}
@@ -0,0 +1,50 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buffer.h"
+
+typedef struct Journal Journal;
+
+// Append-only log of the edits made since the file was last saved, kept
+// next to it as .NAME.mzj. Records are grouped in memory and written and
+// fdatasync'ed at most once a second. The journal is removed on a clean
+// exit, so one found at startup means the last session was lost.
+typedef enum {
+    JOURNAL_INSERT = 1, // insert ch at (y, x)
+    JOURNAL_DELETE,     // delete the character at (y, x)
+    JOURNAL_SPLIT,      // split line y at x
+    JOURNAL_JOIN,       // join line y with the next
+    JOURNAL_TEXT,       // insert text at (y, x); see journal_log_text()
+    JOURNAL_ERASE,      // delete from (y, x) to a second position
+    JOURNAL_SPANS,      // replace spans at once; see journal_log_spans()
+} JournalOp;
+
+// Open the journal of the file at path, after the file has been loaded
+// into B. A journal left over for the file as it is on disk is replayed
+// into B, which takes time proportional to the journal; *recovered is set
+// to the number of edits replayed. A journal for a different version of
+// the file is renamed to .NAME.mzj.stale and left alone.
+Journal *journal_open(const char *path, Buffer *B, size_t *recovered);
+void     journal_close(Journal *J);
+
+void     journal_log(Journal *J, JournalOp op, size_t y, size_t x, int ch);
+// A JOURNAL_TEXT record carries its text, so a paste is one record.
+void     journal_log_text(Journal *J, size_t y, size_t x, const char *s, size_t n);
+void     journal_log_erase(Journal *J, size_t y0, size_t x0, size_t y1, size_t x1);
+// A replace-all is one record holding every span and its new text.
+void     journal_log_spans(Journal *J, const BufferEdit *e, size_t n);
+
+// Write out grouped records once they are due. Returns true while records
+// are waiting, so the caller should call again soon.
+bool     journal_tick(Journal *J);
+
+// After a save, the file on disk holds every edit logged before
+// journal_mark() was called: drop those and keep the rest, now relative to
+// the saved file.
+size_t   journal_mark(Journal *J);
+void     journal_rebase(Journal *J, size_t mark);
+
+#endif
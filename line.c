@@ -5,12 +5,54 @@
 
 #include "util.h"
 
+// Lines shorter than this keep editing with a plain memmove.
+#define LINE_GAP_MIN 1024
+
+static void line_close_gap(Line *ln) {
+    if (!ln->gaplen) return;
+    // the tail includes the terminating NUL
+    memmove(ln->data + ln->gap, ln->data + ln->gap + ln->gaplen, ln->len - ln->gap + 1);
+    ln->gaplen = 0;
+}
+
+// Put the gap at `at`, opening a new one sized to the line when there is
+// none left.
+static void line_move_gap(Line *ln, size_t at) {
+    if (!ln->gaplen) {
+        line_ensure_cap(ln, ln->len + ln->len / 8 + 64);
+        ln->gap = at;
+        ln->gaplen = ln->cap - ln->len - 1;
+        memmove(ln->data + at + ln->gaplen, ln->data + at, ln->len - at + 1);
+        return;
+    }
+    if (at < ln->gap) {
+        memmove(ln->data + at + ln->gaplen, ln->data + at, ln->gap - at);
+    } else if (at > ln->gap) {
+        memmove(ln->data + ln->gap, ln->data + ln->gap + ln->gaplen, at - ln->gap);
+    }
+    ln->gap = at;
+}
+
+static int line_use_gap(const Line *ln) {
+    return ln->gaplen || ln->len >= LINE_GAP_MIN;
+}
+
 void line_ensure_cap(Line *ln, size_t need) {
+    line_close_gap(ln);
     if (need <= ln->cap) return;
     size_t newcap = ln->cap ? ln->cap : 16;
+    if (need <= ln->len) need = ln->len + 1;
     while (newcap < need) newcap *= 2;
-    ln->data = xrealloc(ln->data, newcap);
+    if (ln->cap == 0 && ln->data) {
+        // view: copy out of the borrowed storage
+        char *p = xmalloc(newcap);
+        memcpy(p, ln->data, ln->len);
+        ln->data = p;
+    } else {
+        ln->data = xrealloc(ln->data, newcap);
+    }
     ln->cap = newcap;
+    ln->data[ln->len] = '\0';
 }
 
 Line line_new_from(const char *s, size_t len) {
@@ -22,22 +64,97 @@ Line line_new_from(const char *s, size_t len) {
     return ln;
 }
 
+Line line_view(const char *s, size_t len) {
+    Line ln = {0};
+    ln.data = (char *)s;
+    ln.len = len;
+    return ln;
+}
+
 void line_free(Line *ln) {
-    free(ln->data);
+    if (ln->cap) free(ln->data);
     ln->data = NULL;
     ln->len = ln->cap = 0;
+    ln->gap = ln->gaplen = 0;
 }
 
 void line_insert_char(Line *ln, size_t at, int ch) {
     if (at > ln->len) at = ln->len;
+    if (line_use_gap(ln)) {
+        line_move_gap(ln, at);
+        ln->data[ln->gap++] = (char)ch;
+        ln->gaplen--;
+        ln->len++;
+        return;
+    }
     line_ensure_cap(ln, ln->len + 2);
     memmove(&ln->data[at + 1], &ln->data[at], ln->len - at + 1);
     ln->data[at] = (char)ch;
     ln->len++;
 }
 
+void line_insert(Line *ln, size_t at, const char *s, size_t len) {
+    if (!len) return;
+    if (at > ln->len) at = ln->len;
+    line_ensure_cap(ln, ln->len + len + 1);
+    memmove(ln->data + at + len, ln->data + at, ln->len - at + 1);
+    memcpy(ln->data + at, s, len);
+    ln->len += len;
+}
+
 void line_del_char(Line *ln, size_t at) {
     if (ln->len == 0 || at >= ln->len) return;
+    if (line_use_gap(ln)) {
+        line_move_gap(ln, at);
+        ln->gaplen++;
+        ln->len--;
+        return;
+    }
+    line_ensure_cap(ln, ln->len + 1);
     memmove(&ln->data[at], &ln->data[at + 1], ln->len - at);
     ln->len--;
 }
+
+void line_delete(Line *ln, size_t at, size_t n) {
+    if (at >= ln->len) return;
+    if (n > ln->len - at) n = ln->len - at;
+    line_ensure_cap(ln, ln->len + 1);
+    memmove(ln->data + at, ln->data + at + n, ln->len - at - n + 1);
+    ln->len -= n;
+}
+
+void line_truncate(Line *ln, size_t len) {
+    if (len >= ln->len) return;
+    line_close_gap(ln);
+    ln->len = len;
+    if (ln->cap) ln->data[ln->len] = '\0';
+}
+
+// Contiguous view of the line; closes the gap if there is one.
+const char *line_data(Line *ln) {
+    line_close_gap(ln);
+    return ln->data;
+}
+
+// Run of bytes starting at off that is contiguous in memory, without
+// touching the gap. *n is 0 at or past the end of the line.
+const char *line_peek(const Line *ln, size_t off, size_t *n) {
+    if (off >= ln->len) {
+        *n = 0;
+        return ln->data;
+    }
+    if (ln->gaplen && off >= ln->gap) {
+        *n = ln->len - off;
+        return ln->data + off + ln->gaplen;
+    }
+    *n = (ln->gaplen ? ln->gap : ln->len) - off;
+    return ln->data + off;
+}
+
+void line_append(Line *ln, const char *s, size_t len) {
+    if (!len) return;
+    line_ensure_cap(ln, ln->len + len + 1);
+    memcpy(ln->data + ln->len, s, len);
+    ln->len += len;
+    ln->data[ln->len] = '\0';
+}
@@ -3,16 +3,34 @@
 
 #include <stddef.h>
 
+// A line with cap == 0 and data != NULL is a view: it borrows its bytes from
+// the buffer's original or add storage and is copied into its own allocation
+// on the first write. Views are not NUL-terminated.
+//
+// Long lines edit through a gap buffer: bytes [gap, gap + gaplen) of data
+// are unused and the gap follows the edit position, so repeated typing at
+// one spot does not move the rest of the line. While gaplen > 0, data is
+// not contiguous; use line_peek() to read runs or line_data() to close the
+// gap.
 typedef struct {
     char  *data;
     size_t len;
     size_t cap;
+    size_t gap;
+    size_t gaplen;
 } Line;
 
 void line_ensure_cap(Line *ln, size_t need);
 Line line_new_from(const char *s, size_t len);
+Line line_view(const char *s, size_t len);
 void line_free(Line *ln);
 void line_insert_char(Line *ln, size_t at, int ch);
+void line_insert(Line *ln, size_t at, const char *s, size_t len);
 void line_del_char(Line *ln, size_t at);
+void line_delete(Line *ln, size_t at, size_t n);
+void line_truncate(Line *ln, size_t len);
+const char *line_data(Line *ln);
+const char *line_peek(const Line *ln, size_t off, size_t *n);
+void line_append(Line *ln, const char *s, size_t len);
 
 #endif
@@ -0,0 +1,492 @@
+#include "linetree.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define LT_MAX 64
+#define LT_MIN (LT_MAX / 2)
+
+struct LtNode {
+    bool leaf;
+    int  n;
+    union {
+        Line line[LT_MAX];
+        struct {
+            LtNode *kid[LT_MAX];
+            size_t  cnt[LT_MAX];
+            size_t  bytes[LT_MAX];
+        } in;
+    } u;
+};
+
+static LtNode *node_new(bool leaf) {
+    LtNode *nd = xmalloc(sizeof(*nd));
+    nd->leaf = leaf;
+    nd->n = 0;
+    return nd;
+}
+
+static void node_free(LtNode *nd) {
+    if (nd->leaf) {
+        for (int i = 0; i < nd->n; i++) line_free(&nd->u.line[i]);
+    } else {
+        for (int i = 0; i < nd->n; i++) node_free(nd->u.in.kid[i]);
+    }
+    free(nd);
+}
+
+static void node_stats(const LtNode *nd, size_t *cnt, size_t *bytes) {
+    size_t c = 0, b = 0;
+    if (nd->leaf) {
+        c = (size_t)nd->n;
+        for (int i = 0; i < nd->n; i++) b += nd->u.line[i].len + 1;
+    } else {
+        for (int i = 0; i < nd->n; i++) {
+            c += nd->u.in.cnt[i];
+            b += nd->u.in.bytes[i];
+        }
+    }
+    *cnt = c;
+    *bytes = b;
+}
+
+static void node_restat(LtNode *nd, int k) {
+    node_stats(nd->u.in.kid[k], &nd->u.in.cnt[k], &nd->u.in.bytes[k]);
+}
+
+// Copy count items from src[spos..] over dst[dpos..].
+static void node_move(LtNode *dst, int dpos, const LtNode *src, int spos, int count) {
+    if (dst->leaf) {
+        memmove(&dst->u.line[dpos], &src->u.line[spos], (size_t)count * sizeof(Line));
+    } else {
+        memmove(&dst->u.in.kid[dpos], &src->u.in.kid[spos], (size_t)count * sizeof(LtNode *));
+        memmove(&dst->u.in.cnt[dpos], &src->u.in.cnt[spos], (size_t)count * sizeof(size_t));
+        memmove(&dst->u.in.bytes[dpos], &src->u.in.bytes[spos], (size_t)count * sizeof(size_t));
+    }
+}
+
+// Shift items [pos, n) by `by` slots; n is left to the caller.
+static void node_shift(LtNode *nd, int pos, int by) {
+    node_move(nd, pos + by, nd, pos, nd->n - pos);
+}
+
+// Split a full node. An append at the end moves nothing, so sequential
+// loads leave full nodes behind.
+static LtNode *node_split(LtNode *nd, int pos) {
+    LtNode *right = node_new(nd->leaf);
+    int mid = pos == nd->n ? nd->n : nd->n / 2;
+    right->n = nd->n - mid;
+    node_move(right, 0, nd, mid, right->n);
+    nd->n = mid;
+    return right;
+}
+
+// Insert kid as child pos of internal node nd. Returns the new right
+// sibling when nd had to split.
+static LtNode *node_add_kid(LtNode *nd, int pos, LtNode *kid) {
+    LtNode *right = NULL;
+    if (nd->n == LT_MAX) {
+        right = node_split(nd, pos);
+        if (pos >= nd->n) {
+            pos -= nd->n;
+            nd = right;
+        }
+    }
+    node_shift(nd, pos, 1);
+    nd->u.in.kid[pos] = kid;
+    nd->n++;
+    node_restat(nd, pos);
+    return right;
+}
+
+// Insert ln at line `at` of the subtree. Returns the new right sibling
+// when nd had to split.
+static LtNode *node_insert(LtNode *nd, size_t at, Line ln) {
+    if (nd->leaf) {
+        int pos = (int)at;
+        LtNode *right = NULL;
+        if (nd->n == LT_MAX) {
+            right = node_split(nd, pos);
+            if (pos >= nd->n) {
+                pos -= nd->n;
+                nd = right;
+            }
+        }
+        node_shift(nd, pos, 1);
+        nd->u.line[pos] = ln;
+        nd->n++;
+        return right;
+    }
+
+    int k = 0;
+    while (k + 1 < nd->n && at > nd->u.in.cnt[k]) at -= nd->u.in.cnt[k++];
+    LtNode *sib = node_insert(nd->u.in.kid[k], at, ln);
+    if (!sib) {
+        nd->u.in.cnt[k]++;
+        nd->u.in.bytes[k] += ln.len + 1;
+        return NULL;
+    }
+
+    // child k split: add sib after it
+    node_restat(nd, k);
+    return node_add_kid(nd, k + 1, sib);
+}
+
+// Child k of nd fell below LT_MIN: merge it with a sibling or even them out.
+static void node_fix(LtNode *nd, int k) {
+    if (nd->n < 2) return;
+    int i = k > 0 ? k - 1 : k;
+    LtNode *a = nd->u.in.kid[i];
+    LtNode *b = nd->u.in.kid[i + 1];
+
+    if (a->n + b->n <= LT_MAX) {
+        node_move(a, a->n, b, 0, b->n);
+        a->n += b->n;
+        free(b);
+        nd->n--;
+        node_move(nd, i + 1, nd, i + 2, nd->n - i - 1);
+        node_restat(nd, i);
+        return;
+    }
+
+    int half = (a->n + b->n) / 2;
+    if (a->n > half) {
+        int m = a->n - half;
+        node_shift(b, 0, m);
+        node_move(b, 0, a, a->n - m, m);
+        a->n -= m;
+        b->n += m;
+    } else {
+        int m = half - a->n;
+        node_move(a, a->n, b, 0, m);
+        b->n -= m;
+        node_move(b, 0, b, m, b->n);
+        a->n += m;
+    }
+    node_restat(nd, i);
+    node_restat(nd, i + 1);
+}
+
+static Line node_remove(LtNode *nd, size_t at) {
+    if (nd->leaf) {
+        Line out = nd->u.line[at];
+        nd->n--;
+        node_move(nd, (int)at, nd, (int)at + 1, nd->n - (int)at);
+        return out;
+    }
+
+    int k = 0;
+    while (k + 1 < nd->n && at >= nd->u.in.cnt[k]) at -= nd->u.in.cnt[k++];
+    Line out = node_remove(nd->u.in.kid[k], at);
+    nd->u.in.cnt[k]--;
+    nd->u.in.bytes[k] -= out.len + 1;
+    LtNode *kid = nd->u.in.kid[k];
+    if (kid->n == 0) {
+        // Only a child with no sibling to merge into gets here (a split on
+        // append leaves nodes with one entry); drop it, and nd with it if
+        // that was its last child.
+        free(kid);
+        nd->n--;
+        node_move(nd, k, nd, k + 1, nd->n - k);
+    } else if (kid->n < LT_MIN) {
+        node_fix(nd, k);
+    }
+    return out;
+}
+
+void linetree_init(LineTree *T) {
+    T->root = node_new(true);
+    T->nlines = 0;
+    T->bytes = 0;
+}
+
+void linetree_free(LineTree *T) {
+    if (T->root) node_free(T->root);
+    T->root = NULL;
+    T->nlines = T->bytes = 0;
+}
+
+Line *linetree_get(LineTree *T, size_t at) {
+    LtNode *nd = T->root;
+    while (!nd->leaf) {
+        int k = 0;
+        while (k + 1 < nd->n && at >= nd->u.in.cnt[k]) at -= nd->u.in.cnt[k++];
+        nd = nd->u.in.kid[k];
+    }
+    return &nd->u.line[at];
+}
+
+void linetree_insert(LineTree *T, size_t at, Line ln) {
+    if (at > T->nlines) at = T->nlines;
+    LtNode *sib = node_insert(T->root, at, ln);
+    if (sib) {
+        LtNode *root = node_new(false);
+        root->n = 2;
+        root->u.in.kid[0] = T->root;
+        root->u.in.kid[1] = sib;
+        node_restat(root, 0);
+        node_restat(root, 1);
+        T->root = root;
+    }
+    T->nlines++;
+    T->bytes += ln.len + 1;
+}
+
+Line linetree_remove(LineTree *T, size_t at) {
+    Line out = node_remove(T->root, at);
+    while (!T->root->leaf && T->root->n == 1) {
+        LtNode *old = T->root;
+        T->root = old->u.in.kid[0];
+        free(old);
+    }
+    T->nlines--;
+    T->bytes -= out.len + 1;
+    return out;
+}
+
+static int node_height(const LtNode *nd) {
+    int h = 0;
+    for (; !nd->leaf; nd = nd->u.in.kid[0]) h++;
+    return h;
+}
+
+// Hang subtree s (height hs) off the left or right edge of nd (height
+// hn > hs). Returns the new right sibling when nd had to split.
+static LtNode *node_attach(LtNode *nd, int hn, LtNode *s, int hs, bool left) {
+    int k = left ? 0 : nd->n - 1;
+    if (hn == hs + 1) return node_add_kid(nd, left ? 0 : nd->n, s);
+    LtNode *sib = node_attach(nd->u.in.kid[k], hn - 1, s, hs, left);
+    node_restat(nd, k);
+    return sib ? node_add_kid(nd, k + 1, sib) : NULL;
+}
+
+// Move every line of U to the end of T in O(log n); U is left empty.
+void linetree_concat(LineTree *T, LineTree *U) {
+    if (U->nlines == 0) return;
+    if (T->nlines == 0) {
+        LtNode *tmp = T->root;
+        *T = *U;
+        U->root = tmp;
+        U->nlines = U->bytes = 0;
+        return;
+    }
+
+    int ht = node_height(T->root), hu = node_height(U->root);
+    LtNode *a = T->root, *b = U->root, *sib = NULL;
+    if (ht > hu) {
+        sib = node_attach(a, ht, b, hu, false);
+    } else if (hu > ht) {
+        sib = node_attach(b, hu, a, ht, true);
+        a = b;
+    } else {
+        sib = b;
+    }
+    if (sib) {
+        LtNode *root = node_new(false);
+        root->n = 2;
+        root->u.in.kid[0] = a;
+        root->u.in.kid[1] = sib;
+        node_restat(root, 0);
+        node_restat(root, 1);
+        a = root;
+    }
+    T->root = a;
+    T->nlines += U->nlines;
+    T->bytes += U->bytes;
+    U->root = node_new(true);
+    U->nlines = U->bytes = 0;
+}
+
+void linetree_resized(LineTree *T, size_t at, ptrdiff_t delta) {
+    LtNode *nd = T->root;
+    while (!nd->leaf) {
+        int k = 0;
+        while (k + 1 < nd->n && at >= nd->u.in.cnt[k]) at -= nd->u.in.cnt[k++];
+        nd->u.in.bytes[k] += (size_t)delta;
+        nd = nd->u.in.kid[k];
+    }
+    T->bytes += (size_t)delta;
+}
+
+size_t linetree_offset(LineTree *T, size_t at) {
+    size_t off = 0;
+    LtNode *nd = T->root;
+    while (!nd->leaf) {
+        int k = 0;
+        while (k + 1 < nd->n && at >= nd->u.in.cnt[k]) {
+            at -= nd->u.in.cnt[k];
+            off += nd->u.in.bytes[k++];
+        }
+        nd = nd->u.in.kid[k];
+    }
+    for (size_t i = 0; i < at; i++) off += nd->u.line[i].len + 1;
+    return off;
+}
+
+size_t linetree_line_at(LineTree *T, size_t off) {
+    size_t at = 0;
+    LtNode *nd = T->root;
+    while (!nd->leaf) {
+        int k = 0;
+        while (k + 1 < nd->n && off >= nd->u.in.bytes[k]) {
+            off -= nd->u.in.bytes[k];
+            at += nd->u.in.cnt[k++];
+        }
+        nd = nd->u.in.kid[k];
+    }
+    int i = 0;
+    while (i + 1 < nd->n && off >= nd->u.line[i].len + 1) off -= nd->u.line[i++].len + 1;
+    return at + (size_t)i;
+}
+
+// Check the subtree at nd, whose top is depth levels down, and return its
+// line and byte counts.
+static const char *node_check(const LtNode *nd, int depth, int *leaf_depth, size_t *cnt,
+                              size_t *bytes) {
+    if (nd->n < 1 || nd->n > LT_MAX) return "node with no entries or too many";
+    if (nd->leaf) {
+        if (*leaf_depth < 0) *leaf_depth = depth;
+        if (depth != *leaf_depth) return "leaves at different depths";
+        node_stats(nd, cnt, bytes);
+        return NULL;
+    }
+    *cnt = *bytes = 0;
+    for (int i = 0; i < nd->n; i++) {
+        size_t c, b;
+        const char *why = node_check(nd->u.in.kid[i], depth + 1, leaf_depth, &c, &b);
+        if (why) return why;
+        if (c != nd->u.in.cnt[i]) return "cached line count does not match";
+        if (b != nd->u.in.bytes[i]) return "cached byte count does not match";
+        *cnt += c;
+        *bytes += b;
+    }
+    return NULL;
+}
+
+const char *linetree_check(const LineTree *T) {
+    if (T->root->leaf && T->root->n == 0) return T->nlines || T->bytes ? "empty tree with lines" : NULL;
+    if (!T->root->leaf && T->root->n < 2) return "root with one child";
+    int leaf_depth = -1;
+    size_t cnt, bytes;
+    const char *why = node_check(T->root, 0, &leaf_depth, &cnt, &bytes);
+    if (why) return why;
+    if (cnt != T->nlines) return "line count does not match";
+    if (bytes != T->bytes) return "byte count does not match";
+    return NULL;
+}
+
+void linetree_build_begin(LtBuilder *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+// Append a finished node as the last child of the open node one level up.
+static void build_push(LtBuilder *b, int lvl, LtNode *kid) {
+    LtNode *nd = b->level[lvl];
+    if (!nd) nd = b->level[lvl] = node_new(false);
+    nd->u.in.kid[nd->n] = kid;
+    node_restat(nd, nd->n);
+    nd->n++;
+    if (nd->n == LT_MAX) {
+        b->level[lvl] = NULL;
+        build_push(b, lvl + 1, nd);
+    }
+}
+
+void linetree_build_add(LtBuilder *b, Line ln) {
+    LtNode *leaf = b->level[0];
+    if (!leaf) leaf = b->level[0] = node_new(true);
+    leaf->u.line[leaf->n++] = ln;
+    b->nlines++;
+    b->bytes += ln.len + 1;
+    if (leaf->n == LT_MAX) {
+        b->level[0] = NULL;
+        build_push(b, 1, leaf);
+    }
+}
+
+// A node on the right edge can be left with as little as one entry. Going
+// down that edge, top up each one to LT_MIN from its left sibling, which
+// is full: the entries taken from it are full nodes too.
+static void build_balance(LtNode *nd) {
+    while (!nd->leaf) {
+        int k = nd->n - 1;
+        LtNode *b = nd->u.in.kid[k];
+        if (k > 0 && b->n < LT_MIN) {
+            LtNode *a = nd->u.in.kid[k - 1];
+            int m = LT_MIN - b->n;
+            node_shift(b, 0, m);
+            node_move(b, 0, a, a->n - m, m);
+            a->n -= m;
+            b->n += m;
+            node_restat(nd, k - 1);
+            node_restat(nd, k);
+        }
+        nd = b;
+    }
+}
+
+// Close the open nodes bottom-up; each becomes the last child of the one
+// above it.
+void linetree_build_end(LtBuilder *b, LineTree *T) {
+    LtNode *carry = NULL;
+    for (int lvl = 0; lvl < LT_LEVELS; lvl++) {
+        LtNode *nd = b->level[lvl];
+        if (carry && lvl > 0) {
+            if (!nd) nd = node_new(false);
+            nd->u.in.kid[nd->n] = carry;
+            node_restat(nd, nd->n);
+            nd->n++;
+        }
+        if (nd) carry = nd;
+    }
+    if (!carry) carry = node_new(true);
+    while (!carry->leaf && carry->n == 1) {
+        LtNode *old = carry;
+        carry = old->u.in.kid[0];
+        free(old);
+    }
+    build_balance(carry);
+    T->root = carry;
+    T->nlines = b->nlines;
+    T->bytes = b->bytes;
+}
+
+void linetree_iter_begin(LineTree *T, size_t at, LtIter *it) {
+    it->depth = 0;
+    if (at >= T->nlines) return;
+    LtNode *nd = T->root;
+    while (!nd->leaf) {
+        int k = 0;
+        while (k + 1 < nd->n && at >= nd->u.in.cnt[k]) at -= nd->u.in.cnt[k++];
+        it->path[it->depth] = nd;
+        it->idx[it->depth++] = k;
+        nd = nd->u.in.kid[k];
+    }
+    it->path[it->depth] = nd;
+    it->idx[it->depth++] = (int)at;
+}
+
+Line *linetree_iter_next(LtIter *it) {
+    if (it->depth == 0) return NULL;
+    int d = it->depth - 1;
+    while (it->idx[d] >= it->path[d]->n) {
+        // Leaf done: climb to the first ancestor with a child to the right
+        // and descend along the left edge of that child. Go round again if
+        // that leaf is empty.
+        do d--;
+        while (d >= 0 && it->idx[d] + 1 >= it->path[d]->n);
+        if (d < 0) {
+            it->depth = 0;
+            return NULL;
+        }
+        it->idx[d]++;
+        for (; d + 1 < it->depth; d++) {
+            it->path[d + 1] = it->path[d]->u.in.kid[it->idx[d]];
+            it->idx[d + 1] = 0;
+        }
+    }
+    return &it->path[d]->u.line[it->idx[d]++];
+}
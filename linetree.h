@@ -0,0 +1,67 @@
+#ifndef LINETREE_H
+#define LINETREE_H
+
+#include <stddef.h>
+
+#include "line.h"
+
+typedef struct LtNode LtNode;
+
+// B+tree of lines keyed by line number. Internal nodes cache the line and
+// byte count of every child, so lookup by line, lookup by byte offset and
+// single-line insert/remove are all O(log n). A line counts len + 1 bytes
+// (its newline), which makes the total the size of the saved file.
+typedef struct {
+    LtNode *root;
+    size_t  nlines;
+    size_t  bytes;
+} LineTree;
+
+void   linetree_init(LineTree *T);
+void   linetree_free(LineTree *T);
+
+Line  *linetree_get(LineTree *T, size_t at);
+void   linetree_insert(LineTree *T, size_t at, Line ln);
+Line   linetree_remove(LineTree *T, size_t at);
+
+void   linetree_concat(LineTree *T, LineTree *U);
+
+// Record that the line at `at` changed length by delta bytes.
+void   linetree_resized(LineTree *T, size_t at, ptrdiff_t delta);
+
+size_t linetree_offset(LineTree *T, size_t at);
+size_t linetree_line_at(LineTree *T, size_t off);
+
+// Check the structure of T: no node is empty (but an empty tree's root
+// leaf), all leaves are at the same depth, and the cached line and byte
+// counts match what is below them. Returns NULL, or what is wrong.
+const char *linetree_check(const LineTree *T);
+
+// Bottom-up construction from lines in document order, without a descent
+// per line. Every node off the right edge ends up full, and every node on
+// it but the root at least half full.
+// linetree_build_end() initializes T.
+#define LT_LEVELS 12
+
+typedef struct {
+    LtNode *level[LT_LEVELS]; // the open (partially filled) node of each level
+    size_t  nlines;
+    size_t  bytes;
+} LtBuilder;
+
+void   linetree_build_begin(LtBuilder *b);
+void   linetree_build_add(LtBuilder *b, Line ln);
+void   linetree_build_end(LtBuilder *b, LineTree *T);
+
+// Walk the lines from `at` onwards in order, one leaf at a time. The tree
+// must not change while an iterator is in use.
+typedef struct {
+    LtNode *path[LT_LEVELS]; // root .. leaf
+    int     idx[LT_LEVELS];  // next line in the leaf, current child above
+    int     depth;           // 0 once the walk is over
+} LtIter;
+
+void   linetree_iter_begin(LineTree *T, size_t at, LtIter *it);
+Line  *linetree_iter_next(LtIter *it);
+
+#endif
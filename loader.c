@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+#include "loader.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+#include "util.h"
+
+// The first chunk is small so the first screen is ready at once; later
+// chunks grow to keep the number of splices down.
+#define LOAD_FIRST_CHUNK (64u << 10)
+#define LOAD_CHUNK_MAX   (16u << 20)
+
+typedef struct LoadChunk {
+    struct LoadChunk *next;
+    LineTree lines;
+    size_t end; // text indexed up to here
+} LoadChunk;
+
+struct Loader {
+    const char *p;
+    size_t len;
+    pthread_t tid;
+
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    LoadChunk *head, *tail; // built, not yet handed to the document
+    bool finished;
+    bool cancel;
+
+    size_t done; // bytes handed to the document
+};
+
+// Add the lines found in ix. The text after the last newline becomes a
+// line only when `last` is set.
+static void build_lines(LtBuilder *b, const char *p, size_t len, const LineIndex *ix, bool last) {
+    size_t start = 0;
+    for (size_t k = 0; k <= ix->n; k++) {
+        size_t end = k < ix->n ? ix->nl[k] : len;
+        if (k == ix->n && (!last || start == len)) break;
+        // Strip trailing \n / \r\n
+        size_t n = end - start;
+        if (ix->has_cr) {
+            while (n && p[start + n - 1] == '\r') n--;
+        }
+        linetree_build_add(b, line_view(p + start, n));
+        start = end + 1;
+    }
+}
+
+void load_lines(const char *p, size_t len, LineTree *T) {
+    LineIndex ix;
+    scan_index(p, len, &ix);
+    LtBuilder b;
+    linetree_build_begin(&b);
+    build_lines(&b, p, len, &ix, true);
+    linetree_build_end(&b, T);
+    scan_index_free(&ix);
+}
+
+static void *loader_main(void *arg) {
+    Loader *L = arg;
+    size_t pos = 0, want = LOAD_FIRST_CHUNK;
+
+    while (pos < L->len) {
+        size_t end = L->len - pos > want ? pos + want : L->len;
+        LineIndex ix;
+        scan_index(L->p + pos, end - pos, &ix);
+        if (end < L->len && ix.n == 0) {
+            // no line ends in this chunk: take a bigger bite
+            scan_index_free(&ix);
+            want *= 2;
+            continue;
+        }
+        size_t stop = end == L->len ? end : pos + ix.nl[ix.n - 1] + 1;
+
+        LoadChunk *c = xmalloc(sizeof(*c));
+        LtBuilder b;
+        linetree_build_begin(&b);
+        build_lines(&b, L->p + pos, stop - pos, &ix, stop == L->len);
+        linetree_build_end(&b, &c->lines);
+        scan_index_free(&ix);
+        c->end = stop;
+        c->next = NULL;
+
+        pthread_mutex_lock(&L->mu);
+        bool cancel = L->cancel;
+        if (!cancel) {
+            if (L->tail) L->tail->next = c;
+            else L->head = c;
+            L->tail = c;
+            pthread_cond_signal(&L->cv);
+        }
+        pthread_mutex_unlock(&L->mu);
+        if (cancel) {
+            linetree_free(&c->lines);
+            free(c);
+            break;
+        }
+
+        pos = stop;
+        if (want < LOAD_CHUNK_MAX) want *= 2;
+    }
+
+    pthread_mutex_lock(&L->mu);
+    L->finished = true;
+    pthread_cond_signal(&L->cv);
+    pthread_mutex_unlock(&L->mu);
+    return NULL;
+}
+
+// Returns NULL if the worker cannot be started.
+Loader *loader_start(const char *p, size_t len) {
+    Loader *L = xmalloc(sizeof(*L));
+    memset(L, 0, sizeof(*L));
+    L->p = p;
+    L->len = len;
+    pthread_mutex_init(&L->mu, NULL);
+    pthread_cond_init(&L->cv, NULL);
+    if (pthread_create(&L->tid, NULL, loader_main, L) != 0) {
+        pthread_mutex_destroy(&L->mu);
+        pthread_cond_destroy(&L->cv);
+        free(L);
+        return NULL;
+    }
+    return L;
+}
+
+// Move finished chunks onto the end of T. With wait set, block until at
+// least one chunk (or the end of the text) arrives. Returns false once
+// the whole text is in T.
+bool loader_poll(Loader *L, LineTree *T, bool wait) {
+    pthread_mutex_lock(&L->mu);
+    while (wait && !L->head && !L->finished) pthread_cond_wait(&L->cv, &L->mu);
+    LoadChunk *c = L->head;
+    L->head = L->tail = NULL;
+    bool finished = L->finished;
+    pthread_mutex_unlock(&L->mu);
+
+    while (c) {
+        LoadChunk *next = c->next;
+        linetree_concat(T, &c->lines);
+        linetree_free(&c->lines);
+        L->done = c->end;
+        free(c);
+        c = next;
+    }
+    return !finished;
+}
+
+size_t loader_done(const Loader *L) {
+    return L->done;
+}
+
+// Stop the worker (if still running) and drop chunks not yet polled.
+void loader_free(Loader *L) {
+    pthread_mutex_lock(&L->mu);
+    L->cancel = true;
+    pthread_mutex_unlock(&L->mu);
+    pthread_join(L->tid, NULL);
+
+    while (L->head) {
+        LoadChunk *next = L->head->next;
+        linetree_free(&L->head->lines);
+        free(L->head);
+        L->head = next;
+    }
+    pthread_mutex_destroy(&L->mu);
+    pthread_cond_destroy(&L->cv);
+    free(L);
+}
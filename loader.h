@@ -0,0 +1,23 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "linetree.h"
+
+typedef struct Loader Loader;
+
+// Index p[0..len) into T as views, one line per '\n' (trailing '\r' is
+// stripped). The last line may be unterminated.
+void    load_lines(const char *p, size_t len, LineTree *T);
+
+// Background indexing: a worker thread builds the lines of p in chunks
+// and loader_poll() moves finished chunks onto the end of T. p must stay
+// valid until loader_free().
+Loader *loader_start(const char *p, size_t len);
+bool    loader_poll(Loader *L, LineTree *T, bool wait);
+size_t  loader_done(const Loader *L);
+void    loader_free(Loader *L);
+
+#endif
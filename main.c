@@ -2,34 +2,74 @@
 
 #include <locale.h>
 #include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+#include "script.h"
+
+// --record: every key typed, as a script bench/bench_keys can replay
+static ScriptWriter record;
+
+static void record_key(int c) {
+    size_t n = 0;
+    const char *paste = c == SCREEN_PASTE ? screen_paste(&n) : NULL;
+    script_write_key(&record, c, paste, n);
+}
+
+// Ctrl+Q leaves through exit()
+static void record_end(void) {
+    script_write_close(&record);
+}
 
 int main(int argc, char **argv) {
     setlocale(LC_ALL, "");
 
-    Editor E;
-    editor_init(&E, argc >= 2 ? argv[1] : NULL);
-
-    initscr();
-    raw();               // raw mode (Ctrl+Z etc. handled by us)
-    noecho();            // don't echo keys
-    keypad(stdscr, TRUE);
-    set_escdelay(25);
-    curs_set(1);
-
-    // Use terminal default colors if supported
-    if (has_colors()) {
-        start_color();
-        use_default_colors();
+    // --vt: draw with the built-in VT renderer instead of ncurses
+    ScreenKind kind = SCREEN_CURSES;
+    const char *path = NULL, *rec = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--vt") == 0) {
+            kind = SCREEN_VT;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            rec = argv[++i];
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--vt] [--record keys.txt] [file]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rec) {
+        FILE *f = fopen(rec, "w");
+        if (!f) {
+            perror(rec);
+            return 1;
+        }
+        script_write_open(&record, f);
+        screen_key_hook(record_key);
+        atexit(record_end);
     }
 
+    Editor E;
+    editor_init(&E, path);
+
+    screen_init(kind);
+
     while (1) {
+        int wait = editor_poll(&E);
         editor_refresh_screen(&E);
-        int c = getch();
-        editor_process_key(&E, c);
+        // keep waking up while a file loads or a search runs
+        int c = screen_getch(wait);
+        if (c == ERR) continue;
+        // handle everything already typed before drawing again
+        do editor_process_key(&E, c);
+        while ((c = screen_getch(0)) != ERR);
     }
 
     // unreachable
     editor_free(&E);
-    endwin();
+    screen_end();
     return 0;
 }
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include "save.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Spans shorter than SAVE_COPY_MAX are copied into the staging buffer, so
+// runs of short lines and their newlines leave as one iovec. Longer spans
+// are written straight from the snapshot.
+#define SAVE_COPY_MAX   512
+#define SAVE_STAGE_SIZE (256u << 10)
+#define SAVE_IOV        1024
+
+// Unchanged runs of the original text at least this long are copied from
+// the source file in the kernel (or shared, where the file system can
+// reflink) rather than written from memory.
+#define SAVE_CLONE_MIN  (64u << 10)
+
+// Text of one or more lines; a newline follows each span.
+typedef struct {
+    const char *p;
+    size_t n;
+} SaveSpan;
+
+struct SaveJob {
+    Buffer *B;
+    char *path;
+    bool sync;
+
+    // The snapshot. Views point into the document's original text and
+    // arena, which the pin keeps unchanged; lines with their own storage
+    // are copied into `copies`.
+    SaveSpan *span;
+    size_t nspan, cap;
+    Arena copies;
+    int src_fd; // file holding the original text, or -1
+    const char *src;
+    size_t src_len;
+    size_t bytes;
+
+    pthread_t tid;
+    bool threaded;
+    pthread_mutex_t mu;
+    size_t written;
+    bool finished;
+    int err;
+};
+
+typedef struct {
+    SaveJob *J;
+    int fd;
+    int err;
+    struct iovec iov[SAVE_IOV];
+    int niov;
+    char *stage;
+    size_t staged;
+} SaveBatch;
+
+static void batch_progress(SaveBatch *s, size_t n) {
+    pthread_mutex_lock(&s->J->mu);
+    s->J->written += n;
+    pthread_mutex_unlock(&s->J->mu);
+}
+
+static void batch_flush(SaveBatch *s) {
+    struct iovec *v = s->iov;
+    int n = s->niov;
+    size_t total = 0;
+    while (n > 0 && !s->err) {
+        ssize_t w = writev(s->fd, v, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            s->err = w < 0 ? errno : EIO;
+            break;
+        }
+        // Skip what was written; a short write resumes mid-iovec.
+        size_t left = (size_t)w;
+        total += left;
+        while (n > 0 && left >= v->iov_len) {
+            left -= v->iov_len;
+            v++;
+            n--;
+        }
+        if (n > 0) {
+            v->iov_base = (char *)v->iov_base + left;
+            v->iov_len -= left;
+        }
+    }
+    s->niov = 0;
+    s->staged = 0;
+    if (total) batch_progress(s, total);
+}
+
+static void batch_add(SaveBatch *s, const char *p, size_t n) {
+    if (s->err || !n) return;
+    if (s->niov == SAVE_IOV) batch_flush(s);
+    if (n < SAVE_COPY_MAX) {
+        if (s->staged + n > SAVE_STAGE_SIZE) batch_flush(s);
+        char *dst = s->stage + s->staged;
+        memcpy(dst, p, n);
+        s->staged += n;
+        struct iovec *last = s->niov ? &s->iov[s->niov - 1] : NULL;
+        if (last && (char *)last->iov_base + last->iov_len == dst) {
+            last->iov_len += n;
+            return;
+        }
+        p = dst;
+    }
+    s->iov[s->niov++] = (struct iovec){ .iov_base = (void *)p, .iov_len = n };
+}
+
+// Copy up to len bytes of the source file at off to the end of the
+// output. Returns the number copied, which falls short when the kernel
+// cannot copy between these two files.
+static size_t batch_clone(SaveBatch *s, size_t off, size_t len) {
+    batch_flush(s);
+    size_t done = 0;
+    while (done < len && !s->err) {
+        loff_t in = (loff_t)(off + done);
+        ssize_t n = copy_file_range(s->J->src_fd, &in, s->fd, NULL, len - done, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+        batch_progress(s, (size_t)n);
+    }
+    return done;
+}
+
+// Emit a span and its newline. Long runs of original text are copied from
+// the source file; once a copy fails, this and every later span is
+// written from memory.
+static void batch_span(SaveBatch *s, const char *p, size_t n) {
+    SaveJob *J = s->J;
+    if (J->src_fd >= 0 && n >= SAVE_CLONE_MIN && p >= J->src && p + n <= J->src + J->src_len) {
+        size_t done = batch_clone(s, (size_t)(p - J->src), n);
+        if (done < n) J->src_fd = -1;
+        p += done;
+        n -= done;
+    }
+    batch_add(s, p, n);
+    batch_add(s, "\n", 1);
+}
+
+static int write_spans(SaveJob *J, int fd) {
+    SaveBatch *s = xmalloc(sizeof(*s));
+    s->J = J;
+    s->fd = fd;
+    s->err = 0;
+    s->niov = 0;
+    s->stage = xmalloc(SAVE_STAGE_SIZE);
+    s->staged = 0;
+
+    for (size_t i = 0; i < J->nspan && !s->err; i++) batch_span(s, J->span[i].p, J->span[i].n);
+    batch_flush(s);
+
+    int err = s->err;
+    free(s->stage);
+    free(s);
+    return err;
+}
+
+// The directory part of path, for O_TMPFILE and the directory fsync.
+static char *dir_of(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) return xstrdup(".");
+    if (slash == path) return xstrdup("/");
+    size_t n = (size_t)(slash - path);
+    char *dir = xmalloc(n + 1);
+    memcpy(dir, path, n);
+    dir[n] = '\0';
+    return dir;
+}
+
+static void sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+// Fill fd with the document.
+static int write_contents(SaveJob *J, int fd, bool existed, mode_t mode) {
+    pthread_mutex_lock(&J->mu);
+    J->written = 0;
+    pthread_mutex_unlock(&J->mu);
+    int err = 0;
+    if (existed && fchmod(fd, mode) != 0) err = errno;
+    if (!err) err = write_spans(J, fd);
+    if (!err && J->sync && fsync(fd) != 0) err = errno;
+    return err;
+}
+
+static int write_file(SaveJob *J) {
+    // Keep the permissions of the file being replaced.
+    struct stat st;
+    bool existed = stat(J->path, &st) == 0;
+    mode_t mode = existed ? st.st_mode & 07777 : 0666;
+
+    char *dir = dir_of(J->path);
+    size_t tmpsz = strlen(J->path) + 8;
+    char *tmp = xmalloc(tmpsz);
+    snprintf(tmp, tmpsz, "%s.tmp", J->path);
+
+    // An unnamed file only gets a name once it is complete, so a failed
+    // save leaves nothing behind.
+    bool named = false;
+    int err = 0;
+#ifdef O_TMPFILE
+    int fd = open(dir, O_TMPFILE | O_WRONLY, mode);
+    if (fd >= 0) {
+        err = write_contents(J, fd, existed, mode);
+        if (!err) {
+            char proc[64];
+            snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+            unlink(tmp);
+            named = linkat(AT_FDCWD, proc, AT_FDCWD, tmp, AT_SYMLINK_FOLLOW) == 0;
+        }
+        if (close(fd) != 0 && !err) err = errno;
+    }
+#endif
+
+    // Without O_TMPFILE, or when it cannot be linked (no /proc, or a file
+    // system that refuses), write the named file from the start.
+    if (!err && !named) {
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        if (fd < 0) {
+            err = errno;
+        } else {
+            named = true;
+            err = write_contents(J, fd, existed, mode);
+            if (close(fd) != 0 && !err) err = errno;
+        }
+    }
+
+    if (!err && rename(tmp, J->path) != 0) err = errno;
+    if (err && named) unlink(tmp);
+    if (!err && J->sync) sync_dir(dir);
+
+    free(tmp);
+    free(dir);
+    return err;
+}
+
+static void snap_add(SaveJob *J, const char *p, size_t n) {
+    if (J->nspan == J->cap) {
+        J->cap = J->cap ? J->cap * 2 : 1024;
+        J->span = xrealloc(J->span, J->cap * sizeof(SaveSpan));
+    }
+    J->span[J->nspan++] = (SaveSpan){ .p = p, .n = n };
+}
+
+// The original text can be copied from its file only while the file still
+// holds what was loaded.
+static bool source_intact(const Buffer *B) {
+    struct stat st;
+    return B->orig_fd >= 0 && fstat(B->orig_fd, &st) == 0 && (size_t)st.st_size == B->orig_len &&
+           st.st_mtim.tv_sec == B->orig_mtime.tv_sec && st.st_mtim.tv_nsec == B->orig_mtime.tv_nsec;
+}
+
+// Record the document as spans. Views that follow each other in memory
+// with a newline in between (untouched runs of the original text) become
+// one span; lines with their own storage are copied.
+static void snapshot(SaveJob *J, Buffer *B) {
+    const char *run = NULL;
+    size_t runlen = 0;
+    size_t nlines = buffer_nlines(B);
+    LtIter it;
+    buffer_iter(B, 0, &it);
+    for (size_t y = 0; y < nlines; y++) {
+        const Line *ln = buffer_iter_next(&it);
+        if (ln->cap == 0 && ln->data) {
+            if (run && ln->data == run + runlen + 1 && run[runlen] == '\n') {
+                runlen += 1 + ln->len;
+                continue;
+            }
+            if (run) snap_add(J, run, runlen);
+            run = ln->data;
+            runlen = ln->len;
+            continue;
+        }
+        if (run) {
+            snap_add(J, run, runlen);
+            run = NULL;
+        }
+        char *d = arena_alloc(&J->copies, ln->len);
+        for (size_t x = 0, n; x < ln->len; x += n) {
+            const char *p = line_peek(ln, x, &n);
+            memcpy(d + x, p, n);
+        }
+        snap_add(J, d, ln->len);
+    }
+    if (run) snap_add(J, run, runlen);
+}
+
+static SaveJob *job_new(Buffer *B, const char *path, bool sync) {
+    SaveJob *J = xmalloc(sizeof(*J));
+    memset(J, 0, sizeof(*J));
+    J->B = B;
+    J->path = xstrdup(path);
+    J->sync = sync;
+    arena_init(&J->copies, 1u << 20);
+    J->src_fd = source_intact(B) ? B->orig_fd : -1;
+    J->src = B->orig;
+    J->src_len = B->orig_len;
+    J->bytes = buffer_bytes(B);
+    pthread_mutex_init(&J->mu, NULL);
+
+    snapshot(J, B);
+    buffer_pin(B);
+    return J;
+}
+
+static void *save_main(void *arg) {
+    SaveJob *J = arg;
+    int err = write_file(J);
+    pthread_mutex_lock(&J->mu);
+    J->err = err;
+    J->finished = true;
+    pthread_mutex_unlock(&J->mu);
+    return NULL;
+}
+
+// If no thread can be started the file is written before this returns.
+SaveJob *save_start(Buffer *B, const char *path, bool sync) {
+    SaveJob *J = job_new(B, path, sync);
+    J->threaded = pthread_create(&J->tid, NULL, save_main, J) == 0;
+    if (!J->threaded) save_main(J);
+    return J;
+}
+
+bool save_poll(SaveJob *J) {
+    pthread_mutex_lock(&J->mu);
+    bool finished = J->finished;
+    pthread_mutex_unlock(&J->mu);
+    return !finished;
+}
+
+int save_percent(SaveJob *J) {
+    pthread_mutex_lock(&J->mu);
+    size_t written = J->written;
+    pthread_mutex_unlock(&J->mu);
+    return J->bytes ? (int)(written * 100 / J->bytes) : 100;
+}
+
+int save_finish(SaveJob *J) {
+    if (J->threaded) pthread_join(J->tid, NULL);
+    int err = J->err;
+    buffer_unpin(J->B);
+    arena_free(&J->copies);
+    pthread_mutex_destroy(&J->mu);
+    free(J->span);
+    free(J->path);
+    free(J);
+    return err;
+}
+
+int save_buffer(Buffer *B, const char *path, bool sync) {
+    SaveJob *J = job_new(B, path, sync);
+    save_main(J);
+    return save_finish(J);
+}
@@ -0,0 +1,30 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <stdbool.h>
+
+#include "buffer.h"
+
+typedef struct SaveJob SaveJob;
+
+// Write the document to path, replacing it atomically: the text goes to
+// an unnamed file in the same directory (O_TMPFILE, or path.tmp where that
+// is not supported) which is renamed over path once complete. Line text is
+// gathered into writev() batches; long unchanged runs of the original text
+// are copied from the source file (see buffer_set_source()) with
+// copy_file_range(). With sync set, the file and its directory are
+// fsync'ed before returning. Returns 0 or an errno value.
+int      save_buffer(Buffer *B, const char *path, bool sync);
+
+// Background save: save_start() takes a snapshot of B (a walk over the
+// lines plus a copy of the lines that have their own storage) and writes
+// it on a worker thread. B may be edited meanwhile but stays pinned (see
+// buffer_pin()) until save_finish(), which waits for the worker and
+// returns 0 or an errno value. save_poll() returns true while the worker
+// is still writing.
+SaveJob *save_start(Buffer *B, const char *path, bool sync);
+bool     save_poll(SaveJob *J);
+int      save_percent(SaveJob *J);
+int      save_finish(SaveJob *J);
+
+#endif
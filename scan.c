@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200809L
+#include "scan.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Inputs are split into chunks of at least this size, one per thread.
+#define SCAN_CHUNK_MIN (4u << 20)
+#define SCAN_THREADS_MAX 16
+
+static inline void ix_push(LineIndex *ix, size_t off) {
+    if (ix->n == ix->cap) {
+        ix->cap = ix->cap ? ix->cap * 2 : 1024;
+        ix->nl = xrealloc(ix->nl, ix->cap * sizeof(size_t));
+    }
+    ix->nl[ix->n++] = off;
+}
+
+// Scan p[0..len) and record newlines as base + offset.
+typedef void (*ScanFn)(const char *p, size_t len, size_t base, LineIndex *ix);
+
+static void scan_scalar(const char *p, size_t len, size_t base, LineIndex *ix) {
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\n') ix_push(ix, base + i);
+        else if (p[i] == '\r') ix->has_cr = true;
+    }
+}
+
+#ifdef SCAN_X86
+static void scan_sse2(const char *p, size_t len, size_t base, LineIndex *ix) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    unsigned crmask = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        crmask |= (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+        while (m) {
+            ix_push(ix, base + i + (size_t)__builtin_ctz(m));
+            m &= m - 1;
+        }
+    }
+    if (crmask) ix->has_cr = true;
+    scan_scalar(p + i, len - i, base + i, ix);
+}
+
+__attribute__((target("avx2")))
+static void scan_avx2(const char *p, size_t len, size_t base, LineIndex *ix) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    uint32_t crmask = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        crmask |= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+        while (m) {
+            ix_push(ix, base + i + (size_t)__builtin_ctz(m));
+            m &= m - 1;
+        }
+    }
+    if (crmask) ix->has_cr = true;
+    scan_sse2(p + i, len - i, base + i, ix);
+}
+#endif
+
+static ScanFn scan_kernel(void) {
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2")) return scan_avx2;
+    if (__builtin_cpu_supports("sse2")) return scan_sse2;
+#endif
+    return scan_scalar;
+}
+
+typedef struct {
+    ScanFn fn;
+    const char *p;
+    size_t off;
+    size_t len;
+    LineIndex ix;
+} ScanJob;
+
+static void *scan_job(void *arg) {
+    ScanJob *j = arg;
+    j->fn(j->p + j->off, j->len, j->off, &j->ix);
+    return NULL;
+}
+
+// Index p[0..len). Large inputs are split into chunks that are scanned on
+// separate threads; the per-chunk tables are then joined in order.
+void scan_index(const char *p, size_t len, LineIndex *ix) {
+    memset(ix, 0, sizeof(*ix));
+    ScanFn fn = scan_kernel();
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = len / SCAN_CHUNK_MIN;
+    if (ncpu > 0 && nthreads > (size_t)ncpu) nthreads = (size_t)ncpu;
+    if (nthreads > SCAN_THREADS_MAX) nthreads = SCAN_THREADS_MAX;
+    if (nthreads < 2) {
+        fn(p, len, 0, ix);
+        return;
+    }
+
+    ScanJob jobs[SCAN_THREADS_MAX];
+    pthread_t tids[SCAN_THREADS_MAX];
+    size_t chunk = len / nthreads;
+    for (size_t t = 0; t < nthreads; t++) {
+        jobs[t] = (ScanJob){ .fn = fn, .p = p, .off = t * chunk };
+        jobs[t].len = t + 1 == nthreads ? len - jobs[t].off : chunk;
+    }
+    // the calling thread takes the first chunk
+    size_t started = 1;
+    for (; started < nthreads; started++) {
+        if (pthread_create(&tids[started], NULL, scan_job, &jobs[started]) != 0) break;
+    }
+    scan_job(&jobs[0]);
+    for (size_t t = started; t < nthreads; t++) scan_job(&jobs[t]);
+    for (size_t t = 1; t < started; t++) pthread_join(tids[t], NULL);
+
+    size_t total = 0;
+    for (size_t t = 0; t < nthreads; t++) total += jobs[t].ix.n;
+    ix->nl = xmalloc((total ? total : 1) * sizeof(size_t));
+    ix->cap = total;
+    for (size_t t = 0; t < nthreads; t++) {
+        if (jobs[t].ix.n) memcpy(ix->nl + ix->n, jobs[t].ix.nl, jobs[t].ix.n * sizeof(size_t));
+        ix->n += jobs[t].ix.n;
+        ix->has_cr |= jobs[t].ix.has_cr;
+        free(jobs[t].ix.nl);
+    }
+}
+
+void scan_index_free(LineIndex *ix) {
+    free(ix->nl);
+    memset(ix, 0, sizeof(*ix));
+}
@@ -0,0 +1,18 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Line table of a block of text: the offset of every '\n', ascending.
+typedef struct {
+    size_t *nl;
+    size_t  n;
+    size_t  cap;
+    bool    has_cr; // a '\r' occurs somewhere in the text
+} LineIndex;
+
+void scan_index(const char *p, size_t len, LineIndex *ix);
+void scan_index_free(LineIndex *ix);
+
+#endif
@@ -0,0 +1,222 @@
+#include "screen.h"
+
+#include <ncurses.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "vt.h"
+
+#define PASTE_END  (SCREEN_PASTE + 1)
+#define PASTE_WAIT 1000 // ms to wait for the rest of a paste
+
+static ScreenKind kind;
+static bool active;
+static bool colors; // curses backend: color pairs 1.. are set up
+
+static char  *paste; // curses and null backends
+static size_t npaste, cappaste;
+static char  *paste_text; // the last paste, once its line breaks are fixed
+static size_t paste_len;
+
+// null backend
+static int null_rows = 24, null_cols = 80;
+static const int *null_key;
+static size_t null_nkeys, null_next;
+static char **null_paste;
+static const size_t *null_paste_len;
+static size_t null_npaste; // pastes handed out so far
+
+static void (*key_hook)(int key);
+
+void screen_init(ScreenKind k) {
+    kind = k;
+    active = true;
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) {
+        vt_init();
+        return;
+    }
+
+    initscr();
+    raw();               // raw mode (Ctrl+Z etc. handled by us)
+    noecho();            // don't echo keys
+    keypad(stdscr, TRUE);
+    idlok(stdscr, TRUE); // let screen_scroll() use insert/delete line
+    set_escdelay(25);
+    curs_set(1);
+
+    // bracketed paste: the terminal marks pasted text
+    define_key("\x1b[200~", SCREEN_PASTE);
+    define_key("\x1b[201~", PASTE_END);
+    fputs("\x1b[?2004h", stdout);
+    fflush(stdout);
+
+    // Use terminal default colors if supported; pair c is color c on
+    // the default background
+    if (has_colors()) {
+        start_color();
+        use_default_colors();
+        for (short c = SCREEN_RED; c <= SCREEN_CYAN; c++) init_pair(c, c, -1);
+        colors = true;
+    }
+}
+
+void screen_end(void) {
+    if (!active) return;
+    active = false;
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) {
+        vt_end();
+        return;
+    }
+    endwin();
+    fputs("\x1b[?2004l", stdout);
+    fflush(stdout);
+}
+
+void screen_size(int *rows, int *cols) {
+    if (kind == SCREEN_NULL) *rows = null_rows, *cols = null_cols;
+    else if (kind == SCREEN_VT) vt_size(rows, cols);
+    else getmaxyx(stdscr, *rows, *cols);
+}
+
+void screen_move(int y, int x) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) vt_move(y, x);
+    else move(y, x);
+}
+
+void screen_clrtoeol(void) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) vt_clrtoeol();
+    else clrtoeol();
+}
+
+void screen_addnstr(const char *s, int n) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) vt_addnstr(s, n);
+    else addnstr(s, n);
+}
+
+void screen_addch(int ch) {
+    if (kind == SCREEN_NULL) return;
+    char c = (char)ch;
+    if (kind == SCREEN_VT) vt_addnstr(&c, 1);
+    else addch((chtype)ch);
+}
+
+void screen_reverse(bool on) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) vt_reverse(on);
+    else if (on) attron(A_REVERSE);
+    else attroff(A_REVERSE);
+}
+
+void screen_color(ScreenColor c) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) {
+        vt_color((int)c);
+    } else if (colors) {
+        attroff(A_COLOR);
+        if (c != SCREEN_DEFAULT) attron(COLOR_PAIR(c));
+    }
+}
+
+void screen_scroll(int top, int rows, int n) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) {
+        vt_scroll(top, rows, n);
+        return;
+    }
+    int maxy = getmaxy(stdscr);
+    setscrreg(top, top + rows - 1);
+    scrollok(stdscr, TRUE);
+    scrl(n);
+    // off again so drawing in the bottom right corner does not scroll
+    scrollok(stdscr, FALSE);
+    setscrreg(0, maxy - 1);
+}
+
+void screen_refresh(void) {
+    if (kind == SCREEN_NULL) return;
+    if (kind == SCREEN_VT) vt_refresh();
+    else refresh();
+}
+
+// Collect the keys up to the end of a paste. Keys decoded from escape
+// sequences inside it are dropped.
+static void read_paste(void) {
+    npaste = 0;
+    timeout(PASTE_WAIT);
+    int c;
+    while ((c = getch()) != ERR && c != PASTE_END) {
+        if (c > 0xff) continue;
+        if (npaste == cappaste) {
+            cappaste = cappaste ? cappaste * 2 : 4096;
+            paste = xrealloc(paste, cappaste);
+        }
+        paste[npaste++] = (char)c;
+    }
+}
+
+int screen_getch(int timeout_ms) {
+    int c;
+    if (kind == SCREEN_NULL) {
+        if (null_next == null_nkeys) return timeout_ms < 0 ? 27 : ERR;
+        c = null_key[null_next++];
+        if (c == SCREEN_PASTE) {
+            paste = null_paste[null_npaste];
+            npaste = null_paste_len[null_npaste++];
+        }
+    } else if (kind == SCREEN_VT) {
+        c = vt_getch(timeout_ms);
+    } else {
+        timeout(timeout_ms);
+        c = getch();
+        if (c == SCREEN_PASTE) read_paste();
+        if (c == PASTE_END) c = ERR;
+    }
+    if (c == SCREEN_PASTE) paste_text = NULL;
+    if (c != ERR && key_hook) key_hook(c);
+    return c;
+}
+
+void screen_key_hook(void (*fn)(int key)) {
+    key_hook = fn;
+}
+
+void screen_null_size(int rows, int cols) {
+    null_rows = rows;
+    null_cols = cols;
+}
+
+void screen_null_keys(const int *keys, size_t n, char **pastes, const size_t *paste_lens) {
+    null_key = keys;
+    null_nkeys = n;
+    null_next = 0;
+    null_paste = pastes;
+    null_paste_len = paste_lens;
+    null_npaste = 0;
+}
+
+// Terminals send line breaks in a paste as '\r'; "\r\n" counts as one.
+const char *screen_paste(size_t *len) {
+    if (!paste_text) {
+        char *p = paste;
+        size_t n = npaste;
+        if (kind == SCREEN_VT) p = vt_paste(&n);
+        size_t w = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (p[i] == '\r') {
+                if (i + 1 < n && p[i + 1] == '\n') i++;
+                p[w++] = '\n';
+            } else {
+                p[w++] = p[i];
+            }
+        }
+        paste_text = p;
+        paste_len = w;
+    }
+    *len = paste_len;
+    return paste_text;
+}
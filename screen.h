@@ -0,0 +1,64 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Terminal output and key input. ncurses is the default backend; the VT
+// backend (vt.c) drives the terminal itself with a diffed cell grid and
+// one write() per frame. Keys come back as characters or ncurses KEY_*
+// codes with either backend. The null backend has no terminal at all, for
+// replaying keys in benchmarks.
+typedef enum {
+    SCREEN_CURSES,
+    SCREEN_VT,
+    SCREEN_NULL,
+} ScreenKind;
+
+void screen_init(ScreenKind kind);
+void screen_end(void);
+
+void screen_size(int *rows, int *cols);
+void screen_move(int y, int x);
+void screen_clrtoeol(void);
+void screen_addnstr(const char *s, int n);
+void screen_addch(int ch);
+void screen_reverse(bool on);
+// Text colors, numbered as in the terminal's SGR codes (30 + color).
+// Without color support they all draw as SCREEN_DEFAULT.
+typedef enum {
+    SCREEN_DEFAULT,
+    SCREEN_RED,
+    SCREEN_GREEN,
+    SCREEN_YELLOW,
+    SCREEN_BLUE,
+    SCREEN_MAGENTA,
+    SCREEN_CYAN,
+} ScreenColor;
+void screen_color(ScreenColor c);
+// Scroll rows [top, top + rows) up by n (down if n < 0), blanking the rows
+// that come into view; what the terminal already shows is reused.
+void screen_scroll(int top, int rows, int n);
+void screen_refresh(void);
+
+// Next key, or ERR after timeout_ms (-1 waits for ever). A bracketed
+// paste comes back as one SCREEN_PASTE, outside the range of KEY_* codes.
+#define SCREEN_PASTE 0x6000
+int  screen_getch(int timeout_ms);
+
+// Call fn with every key screen_getch() returns, to record them.
+void screen_key_hook(void (*fn)(int key));
+
+// The text of the last SCREEN_PASTE, line breaks as '\n'. Valid until the
+// next screen_getch().
+const char *screen_paste(size_t *len);
+
+// Null backend: a screen of rows x cols that draws nothing.
+void screen_null_size(int rows, int cols);
+// Keys for screen_getch() to return, in order; each SCREEN_PASTE among
+// them takes the next of the texts in pastes. When they run out it
+// returns ERR, or Esc if told to wait for ever, which backs out of any
+// prompt.
+void screen_null_keys(const int *keys, size_t n, char **pastes, const size_t *paste_lens);
+
+#endif
@@ -0,0 +1,253 @@
+#include "script.h"
+
+#include <ctype.h>
+#include <ncurses.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+#include "util.h"
+
+static const struct {
+    const char *name;
+    int key;
+} key_names[] = {
+    { "Up", KEY_UP },         { "Down", KEY_DOWN },         { "Left", KEY_LEFT },
+    { "Right", KEY_RIGHT },   { "Home", KEY_HOME },         { "End", KEY_END },
+    { "PageUp", KEY_PPAGE },  { "PageDown", KEY_NPAGE },    { "Backspace", 127 },
+    { "Delete", KEY_DC },     { "Enter", '\r' },            { "Tab", '\t' },
+    { "Esc", 27 },
+};
+
+#define NKEY_NAMES (sizeof(key_names) / sizeof(key_names[0]))
+
+// Bytes typed as text rather than named.
+static bool is_text(int c) {
+    return (c >= 0x20 && c < 0x7f) || (c >= 0x80 && c < 0x100);
+}
+
+void script_init(Script *S) {
+    memset(S, 0, sizeof(*S));
+}
+
+void script_free(Script *S) {
+    for (size_t i = 0; i < S->npaste; i++) free(S->paste[i]);
+    free(S->paste);
+    free(S->paste_len);
+    free(S->key);
+    script_init(S);
+}
+
+static void script_add(Script *S, int key) {
+    if (S->n == S->cap) {
+        S->cap = S->cap ? S->cap * 2 : 256;
+        S->key = xrealloc(S->key, S->cap * sizeof(int));
+    }
+    S->key[S->n++] = key;
+}
+
+static void script_add_paste(Script *S, const char *s, size_t n) {
+    if (S->npaste == S->pastecap) {
+        S->pastecap = S->pastecap ? S->pastecap * 2 : 16;
+        S->paste = xrealloc(S->paste, S->pastecap * sizeof(char *));
+        S->paste_len = xrealloc(S->paste_len, S->pastecap * sizeof(size_t));
+    }
+    // each paste gets its own copy: its line breaks are rewritten in place
+    char *copy = xmalloc(n ? n : 1);
+    memcpy(copy, s, n);
+    S->paste[S->npaste] = copy;
+    S->paste_len[S->npaste++] = n;
+    script_add(S, SCREEN_PASTE);
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// The quoted text at *p (which points at its opening '"'), unescaped into
+// out, which has room for e - *p bytes. Leaves *p after the closing quote.
+static bool parse_quoted(const char **p, const char *e, char *out, size_t *len) {
+    const char *s = *p + 1;
+    size_t n = 0;
+    for (; s < e && *s != '"'; s++) {
+        if (*s != '\\') {
+            out[n++] = *s;
+            continue;
+        }
+        if (++s == e) return false;
+        switch (*s) {
+            case 'n': out[n++] = '\n'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 't': out[n++] = '\t'; break;
+            case '"':
+            case '\\': out[n++] = *s; break;
+            case 'x': {
+                int hi = s + 1 < e ? hex_digit(s[1]) : -1;
+                int lo = s + 2 < e ? hex_digit(s[2]) : -1;
+                if (hi < 0 || lo < 0) return false;
+                out[n++] = (char)(hi << 4 | lo);
+                s += 2;
+                break;
+            }
+            default: return false;
+        }
+    }
+    if (s == e) return false;
+    *p = s + 1;
+    *len = n;
+    return true;
+}
+
+static bool parse_key(const char *s, size_t n, int *key) {
+    for (size_t i = 0; i < NKEY_NAMES; i++) {
+        if (strlen(key_names[i].name) == n && memcmp(key_names[i].name, s, n) == 0) {
+            *key = key_names[i].key;
+            return true;
+        }
+    }
+    if (n == 6 && memcmp(s, "Ctrl+", 5) == 0 && isalpha((unsigned char)s[5])) {
+        *key = toupper((unsigned char)s[5]) & 0x1f;
+        return true;
+    }
+    char num[16], *end;
+    if (n == 0 || n >= sizeof(num) || !isdigit((unsigned char)s[0])) return false;
+    memcpy(num, s, n);
+    num[n] = '\0';
+    long v = strtol(num, &end, 0);
+    if (*end || v < 0 || v > 0xffff) return false;
+    *key = (int)v;
+    return true;
+}
+
+// One line of a script: an item and how many times to repeat it.
+static bool script_item(Script *S, const char *p, const char *e) {
+    while (p < e && isspace((unsigned char)*p)) p++;
+    while (e > p && isspace((unsigned char)e[-1])) e--;
+    if (p == e || *p == '#') return true;
+
+    char *text = NULL;
+    size_t n = 0;
+    int key = ERR;
+    bool paste = false;
+    if (*p == '"' || (e - p > 6 && memcmp(p, "paste ", 6) == 0)) {
+        paste = *p != '"';
+        if (paste) {
+            p += 6;
+            while (p < e && *p == ' ') p++;
+            if (p == e || *p != '"') return false;
+        }
+        text = xmalloc((size_t)(e - p));
+        if (!parse_quoted(&p, e, text, &n)) {
+            free(text);
+            return false;
+        }
+    } else {
+        const char *w = p;
+        while (p < e && *p != '*' && !isspace((unsigned char)*p)) p++;
+        if ((size_t)(p - w) == 4 && memcmp(w, "wait", 4) == 0) key = SCRIPT_WAIT;
+        else if (!parse_key(w, (size_t)(p - w), &key)) return false;
+    }
+
+    size_t times = 1;
+    if (p < e && *p == '*') {
+        char *end;
+        times = strtoul(p + 1, &end, 10);
+        p = end;
+    }
+    bool ok = p == e && times > 0;
+    for (size_t t = 0; ok && t < times; t++) {
+        if (paste) script_add_paste(S, text, n);
+        else if (text) for (size_t i = 0; i < n; i++) script_add(S, (unsigned char)text[i]);
+        else script_add(S, key);
+    }
+    free(text);
+    return ok;
+}
+
+size_t script_parse(Script *S, const char *text, size_t len) {
+    const char *p = text, *end = text + len;
+    for (size_t line = 1; p < end; line++) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        if (!script_item(S, p, eol)) return line;
+        p = eol < end ? eol + 1 : end;
+    }
+    return 0;
+}
+
+const char *script_key_name(int key, char *buf, size_t size) {
+    // the editor takes these the same as 127 and '\r'
+    if (key == KEY_BACKSPACE) return "Backspace";
+    if (key == '\n') return "Enter";
+    for (size_t i = 0; i < NKEY_NAMES; i++) {
+        if (key_names[i].key == key) return key_names[i].name;
+    }
+    if (key >= 1 && key <= 26) snprintf(buf, size, "Ctrl+%c", 'A' + key - 1);
+    else snprintf(buf, size, "%d", key);
+    return buf;
+}
+
+static void put_quoted(FILE *f, const char *s, size_t n) {
+    fputc('"', f);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c == '\n') fputs("\\n", f);
+        else if (c == '\r') fputs("\\r", f);
+        else if (c == '\t') fputs("\\t", f);
+        else if (c >= 0x20 && c < 0x7f) fputc(c, f);
+        else fprintf(f, "\\x%02x", c);
+    }
+    fputc('"', f);
+}
+
+// Write out what is held back.
+static void script_write_flush(ScriptWriter *W) {
+    if (W->ntext) {
+        put_quoted(W->f, W->text, W->ntext);
+        fputc('\n', W->f);
+        W->ntext = 0;
+    }
+    if (W->key == ERR) return;
+    char buf[16];
+    fputs(script_key_name(W->key, buf, sizeof(buf)), W->f);
+    if (W->count > 1) fprintf(W->f, "*%zu", W->count);
+    fputc('\n', W->f);
+    W->key = ERR;
+    W->count = 0;
+}
+
+void script_write_open(ScriptWriter *W, FILE *f) {
+    W->f = f;
+    W->key = ERR;
+    W->count = 0;
+    W->ntext = 0;
+}
+
+void script_write_key(ScriptWriter *W, int key, const char *paste, size_t paste_len) {
+    if (key == SCREEN_PASTE) {
+        script_write_flush(W);
+        fputs("paste ", W->f);
+        put_quoted(W->f, paste, paste_len);
+        fputc('\n', W->f);
+    } else if (is_text(key)) {
+        if (W->key != ERR || W->ntext == sizeof(W->text)) script_write_flush(W);
+        W->text[W->ntext++] = (char)key;
+    } else if (key == W->key) {
+        W->count++;
+    } else {
+        script_write_flush(W);
+        W->key = key;
+        W->count = 1;
+    }
+}
+
+void script_write_close(ScriptWriter *W) {
+    script_write_flush(W);
+    fclose(W->f);
+    W->f = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Keystroke scripts, as recorded by miedit --record and replayed by
+// bench/bench_keys. One item a line:
+//
+//   # a comment
+//   PageDown*100     a key, 100 times
+//   "int x;"         each byte of the text as a key
+//   paste "a\nb"     a bracketed paste
+//   wait             let loading or saving finish
+//
+// Keys are Up Down Left Right Home End PageUp PageDown Backspace Delete
+// Enter Tab Esc, Ctrl+A to Ctrl+Z, or a key code as a number. Quoted text
+// takes the escapes \" \\ \n \r \t and \xHH.
+#define SCRIPT_WAIT (-2)
+
+typedef struct {
+    int *key;           // keys, SCREEN_PASTE and SCRIPT_WAIT
+    size_t n, cap;
+    char **paste;       // the text of each SCREEN_PASTE, in order
+    size_t *paste_len;
+    size_t npaste, pastecap;
+} Script;
+
+void   script_init(Script *S);
+void   script_free(Script *S);
+// Add the items in text[0..len) to S. Returns 0, or the number of the
+// first line that does not parse.
+size_t script_parse(Script *S, const char *text, size_t len);
+
+// The name of key in a script: "PageDown", "Ctrl+S", or its code.
+const char *script_key_name(int key, char *buf, size_t size);
+
+// A script written as keys come in. Runs of text and repeats of a key are
+// held back to be written as one item.
+typedef struct {
+    FILE *f;
+    int key;       // key being repeated, or ERR
+    size_t count;
+    char text[64]; // text being typed
+    size_t ntext;
+} ScriptWriter;
+
+void script_write_open(ScriptWriter *W, FILE *f);
+// paste is the text of a SCREEN_PASTE.
+void script_write_key(ScriptWriter *W, int key, const char *paste, size_t paste_len);
+// Write what is held back and close the file.
+void script_write_close(ScriptWriter *W);
+
+#endif
@@ -0,0 +1,416 @@
+#include "editor_internal.h"
+
+#include <ctype.h>
+#include <ncurses.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "find.h"
+
+// One slice of a scan reads about this many bytes (a few ms) before
+// giving the main loop a chance to take keys; each line also costs a
+// little for the walk itself.
+#define FIND_SLICE     (16u << 20)
+#define FIND_LINE_COST 32
+
+enum { FIND_MORE, FIND_END, FIND_HIT };
+
+static void find_status(Editor *E, const char *note) {
+    Search *S = &E->find;
+    if (S->replacing) editor_set_msg(E, "Replace /%s/ with: %s%s", S->query, S->with, note);
+    else if (S->regex) editor_set_msg(E, "Regex (Enter list, Ctrl+R count, Tab replace): %s%s", S->query, note);
+    else editor_set_msg(E, "Search: %s%s", S->query, note);
+}
+
+static char *find_row(Search *S, size_t n) {
+    if (n > S->rowcap) {
+        S->rowcap = n * 2;
+        S->row = xrealloc(S->row, S->rowcap);
+    }
+    return S->row;
+}
+
+// Copy bytes [from, to) of ln into the row buffer, across the gap.
+static const char *find_copy(Search *S, const Line *ln, size_t from, size_t to) {
+    char *d = find_row(S, to - from);
+    for (size_t x = from, k; x < to; x += k) {
+        const char *p = line_peek(ln, x, &k);
+        if (k > to - x) k = to - x;
+        memcpy(d + (x - from), p, k);
+    }
+    return d;
+}
+
+// A key that goes into the prompt: printable ASCII, or a byte of UTF-8.
+static bool find_typed(int c) {
+    return c < 0x100 && (isprint(c) || c >= 0x80);
+}
+
+// Take the last character off text[0..*len).
+static void find_unput(char *text, size_t *len) {
+    while (*len && ((unsigned char)text[*len - 1] & 0xc0) == 0x80) (*len)--;
+    if (*len) (*len)--;
+    text[*len] = '\0';
+}
+
+// Start looking for the query at (y, x).
+static void find_from(Editor *E, size_t y, size_t x) {
+    Search *S = &E->find;
+    S->scanning = S->len > 0;
+    S->sy = S->ny = y;
+    S->nx = x;
+    S->wrapped = false;
+    find_status(E, S->len ? " (searching)" : "");
+    // the highlights change on every visible row
+    editor_damage(E, E->rowoff, SIZE_MAX);
+}
+
+static void find_close(Editor *E) {
+    E->find.active = false;
+    E->find.scanning = false;
+    editor_set_msg(E, "");
+    editor_damage(E, E->rowoff, SIZE_MAX);
+}
+
+void editor_find(Editor *E, bool regex) {
+    Search *S = &E->find;
+    S->active = true;
+    S->regex = regex;
+    S->replacing = false;
+    S->wlen = 0;
+    S->with[0] = '\0';
+    S->len = 0;
+    S->query[0] = '\0';
+    S->oy = E->cy;
+    S->ox = E->cx;
+    S->scanning = false;
+    find_status(E, "");
+}
+
+// The first match at or after (y, x), or E->nmatches.
+static size_t match_after(const Editor *E, size_t y, size_t x) {
+    size_t lo = 0, hi = E->nmatches;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const GrepMatch *m = &E->matches[mid];
+        if (m->y < y || (m->y == y && m->x < x)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void match_go(Editor *E, size_t i) {
+    const GrepMatch *m = &E->matches[i];
+    // the list is not updated by edits, so it may point past the text
+    size_t n = buffer_nlines(&E->buf);
+    E->cy = m->y < n ? m->y : n - 1;
+    size_t len = buffer_line(&E->buf, E->cy)->len;
+    E->cx = m->x < len ? m->x : len;
+    editor_set_msg(E, "Match %zu of %zu", i + 1, E->nmatches);
+}
+
+// Go to the next (or with back, the previous) match of the last regex
+// search, wrapping around.
+void editor_match_step(Editor *E, bool back) {
+    if (!E->nmatches) {
+        editor_set_msg(E, "No regex matches (Ctrl+R to search)");
+        return;
+    }
+    size_t i = back ? match_after(E, E->cy, E->cx) : match_after(E, E->cy, E->cx + 1);
+    if (back) i = i ? i - 1 : E->nmatches - 1;
+    else if (i == E->nmatches) i = 0;
+    match_go(E, i);
+}
+
+// Close the prompt and check its regex, reporting it if it is bad. The
+// file is loaded in full, so that the search covers all of it.
+static bool find_prepare(Editor *E) {
+    Search *S = &E->find;
+    find_close(E);
+    regex_t re;
+    int err = regcomp(&re, S->query, REG_EXTENDED);
+    if (err) {
+        char why[128];
+        regerror(err, &re, why, sizeof(why));
+        editor_set_msg(E, "Bad regex: %s", why);
+        return false;
+    }
+    regfree(&re);
+
+    size_t nlines = buffer_nlines(&E->buf);
+    buffer_finish_load(&E->buf);
+    if (buffer_nlines(&E->buf) != nlines) editor_damage(E, nlines, SIZE_MAX);
+    return true;
+}
+
+// Run the regex in the prompt over the whole document, for a list of
+// matches to step through or only for their number.
+static void find_grep(Editor *E, bool list) {
+    Search *S = &E->find;
+    if (!find_prepare(E)) return;
+    if (!list) {
+        size_t n = grep_buffer(&E->buf, S->query, REG_EXTENDED, NULL);
+        editor_set_msg(E, "%zu matches of /%s/", n, S->query);
+        return;
+    }
+    free(E->matches);
+    E->matches = NULL;
+    E->nmatches = grep_buffer(&E->buf, S->query, REG_EXTENDED, &E->matches);
+    if (!E->nmatches) {
+        editor_set_msg(E, "No match for /%s/", S->query);
+        return;
+    }
+    size_t i = match_after(E, E->cy, E->cx);
+    match_go(E, i < E->nmatches ? i : 0);
+}
+
+// Replace every match of the regex with the text given, as one edit. The
+// matches are found on all CPUs and then every line with a match is built
+// once at its new length.
+static void find_replace(Editor *E) {
+    Search *S = &E->find;
+    if (!find_prepare(E)) return;
+    GrepMatch *m = NULL;
+    size_t n = grep_buffer(&E->buf, S->query, REG_EXTENDED, &m);
+    if (!n) {
+        editor_set_msg(E, "No match for /%s/", S->query);
+        return;
+    }
+
+    BufferEdit *e = xmalloc(n * sizeof(BufferEdit));
+    size_t nold = 0;
+    for (size_t i = 0; i < n; i++) {
+        e[i] = (BufferEdit){ m[i].y, m[i].x, m[i].n, S->with, S->wlen };
+        nold += m[i].n;
+    }
+    free(m);
+
+    // the text going away, for undo
+    char *old = xmalloc(nold ? nold : 1), *p = old;
+    const Line *ln = NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (!i || e[i].y != e[i - 1].y) ln = buffer_line(&E->buf, e[i].y);
+        for (size_t x = e[i].x, k; x < e[i].x + e[i].n; x += k, p += k) {
+            const char *q = line_peek(ln, x, &k);
+            if (k > e[i].x + e[i].n - x) k = e[i].x + e[i].n - x;
+            memcpy(p, q, k);
+        }
+    }
+    bool kept = undo_replace(&E->undo, e, n, old);
+    editor_replace_spans(E, e, n);
+    free(old);
+    free(e);
+    editor_set_msg(E, "Replaced %zu matches of /%s/%s", n, S->query, kept ? "" : " (too large to undo)");
+}
+
+// Keys while the prompt is open: text edits the query, Ctrl+F finds the
+// next match, Enter keeps the cursor where it is and Esc puts it back.
+// For a regex, Enter or Ctrl+R runs the search instead, and Tab moves on
+// to a replacement for Enter to replace every match with. Any other key
+// closes the prompt and is returned as not handled.
+bool editor_find_key(Editor *E, int c) {
+    Search *S = &E->find;
+    if (S->regex) {
+        // the text being typed: the regex, or after Tab its replacement
+        char *text = S->replacing ? S->with : S->query;
+        size_t *len = S->replacing ? &S->wlen : &S->len;
+        switch (c) {
+            case '\r':
+            case '\n':
+                if (S->replacing) find_replace(E);
+                else find_grep(E, true);
+                return true;
+            case 18: // Ctrl+R
+                if (!S->replacing) find_grep(E, false);
+                return true;
+            case '\t':
+                if (S->len) S->replacing = true;
+                find_status(E, "");
+                return true;
+            case KEY_BACKSPACE:
+            case 127:
+            case 8:
+                find_unput(text, len);
+                find_status(E, "");
+                return true;
+            case 27:
+            case KEY_RESIZE:
+                break;
+            default:
+                if (!find_typed(c)) {
+                    find_close(E);
+                    return false;
+                }
+                if (*len + 1 < sizeof(S->query)) {
+                    text[(*len)++] = (char)c;
+                    text[*len] = '\0';
+                }
+                find_status(E, "");
+                return true;
+        }
+    }
+    switch (c) {
+        case 27:
+            E->cy = S->oy;
+            E->cx = S->ox;
+            find_close(E);
+            return true;
+        case '\r':
+        case '\n':
+            find_close(E);
+            return true;
+        case 6: // Ctrl+F
+            if (S->len) find_from(E, E->cy, E->cx + 1);
+            return true;
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            find_unput(S->query, &S->len);
+            E->cy = S->oy;
+            E->cx = S->ox;
+            find_from(E, S->oy, S->ox);
+            return true;
+        case KEY_RESIZE:
+            return true;
+    }
+    if (find_typed(c)) {
+        if (S->len + 1 < sizeof(S->query)) {
+            S->query[S->len++] = (char)c;
+            S->query[S->len] = '\0';
+        }
+        find_from(E, S->oy, S->ox);
+        return true;
+    }
+    find_close(E);
+    return false;
+}
+
+// Look for the query in p[0..n): whole lines from line y (from column x
+// of it on) that follow each other in memory, newlines included.
+static bool find_run(Editor *E, const char *p, size_t n, size_t y, size_t x, size_t *my, size_t *mx) {
+    const char *hit = find_mem(p, n, E->find.query, E->find.len);
+    if (!hit) return false;
+    const char *line = p, *nl;
+    while ((nl = memchr(line, '\n', (size_t)(hit - line)))) {
+        y++;
+        x = 0;
+        line = nl + 1;
+    }
+    *my = y;
+    *mx = x + (size_t)(hit - line);
+    return true;
+}
+
+// Scan lines [ny, end) for one slice. Lines that are adjacent views of the
+// original text or the arena are searched as one run, so most of a file
+// goes through the kernel in large blocks.
+static int find_scan(Editor *E, size_t end, size_t *my, size_t *mx) {
+    Search *S = &E->find;
+    if (S->ny >= end) return FIND_END;
+
+    const char *run = NULL;
+    size_t runlen = 0, runy = 0, runx = 0, cost = 0;
+    LtIter it;
+    buffer_iter(&E->buf, S->ny, &it);
+    for (size_t y = S->ny; y < end; y++) {
+        const Line *ln = buffer_iter_next(&it);
+        size_t x = y == S->ny ? S->nx : 0;
+        if (x > ln->len) x = ln->len;
+        size_t n = ln->len - x;
+        cost += n + FIND_LINE_COST;
+
+        if (ln->gaplen) {
+            // the row buffer is reused, so search this line right away
+            if (run && find_run(E, run, runlen, runy, runx, my, mx)) return FIND_HIT;
+            run = NULL;
+            if (find_run(E, find_copy(S, ln, x, ln->len), n, y, x, my, mx)) return FIND_HIT;
+        } else if (run && ln->data + x == run + runlen + 1 && run[runlen] == '\n') {
+            runlen += 1 + n;
+        } else {
+            if (run && find_run(E, run, runlen, runy, runx, my, mx)) return FIND_HIT;
+            run = ln->data ? ln->data + x : NULL;
+            runlen = n;
+            runy = y;
+            runx = x;
+        }
+
+        if (cost >= FIND_SLICE && y + 1 < end) {
+            if (run && find_run(E, run, runlen, runy, runx, my, mx)) return FIND_HIT;
+            S->ny = y + 1;
+            S->nx = 0;
+            return FIND_MORE;
+        }
+    }
+    if (run && find_run(E, run, runlen, runy, runx, my, mx)) return FIND_HIT;
+    S->ny = end;
+    return FIND_END;
+}
+
+// One slice of the scan in progress. Returns true while there is more.
+bool editor_find_poll(Editor *E) {
+    Search *S = &E->find;
+    if (!S->scanning) return false;
+    size_t my, mx;
+    size_t end = S->wrapped ? S->sy + 1 : buffer_nlines(&E->buf);
+    switch (find_scan(E, end, &my, &mx)) {
+        case FIND_HIT:
+            E->cy = my;
+            E->cx = mx;
+            S->scanning = false;
+            find_status(E, S->wrapped ? " (wrapped)" : "");
+            return false;
+        case FIND_MORE:
+            return true;
+    }
+    if (!S->wrapped) {
+        S->wrapped = true;
+        S->ny = S->nx = 0;
+        return true;
+    }
+    S->scanning = false;
+    find_status(E, " (not found)");
+    return false;
+}
+
+// The matches of the query that overlap bytes [from, to) of ln, as start
+// and end pairs in *hit; returns how many. The search runs len - 1 bytes
+// past either end, so that a match cut by an edge is still found. *hit
+// stays valid until the next call.
+size_t editor_find_hits(Editor *E, const Line *ln, size_t from, size_t to, const size_t **hit) {
+    Search *S = &E->find;
+    size_t lead = S->len - 1;
+    size_t lo = from > lead ? from - lead : 0;
+    size_t hi = to + lead < ln->len ? to + lead : ln->len;
+    S->nhits = 0;
+    *hit = S->hits;
+    if (lo >= hi) return 0;
+
+    const char *p = find_copy(S, ln, lo, hi), *m;
+    for (size_t at = 0; (m = find_mem(p + at, hi - lo - at, S->query, S->len)); ) {
+        size_t hs = (size_t)(m - p) + lo;
+        at = (size_t)(m - p) + S->len;
+        if (hs + S->len <= from) continue;
+        if (hs >= to) break;
+        if (S->nhits + 2 > S->hitcap) {
+            S->hitcap = S->hitcap ? S->hitcap * 2 : 64;
+            S->hits = xrealloc(S->hits, S->hitcap * sizeof(size_t));
+        }
+        S->hits[S->nhits++] = hs;
+        S->hits[S->nhits++] = hs + S->len;
+    }
+    *hit = S->hits;
+    return S->nhits / 2;
+}
+
+void editor_find_free(Editor *E) {
+    free(E->matches);
+    E->matches = NULL;
+    E->nmatches = 0;
+    free(E->find.row);
+    E->find.row = NULL;
+    E->find.rowcap = 0;
+    free(E->find.hits);
+    E->find.hits = NULL;
+    E->find.hitcap = 0;
+}
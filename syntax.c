@@ -0,0 +1,395 @@
+#define _POSIX_C_SOURCE 200809L
+#include "syntax.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "util.h"
+
+// The end state of a line skipped over by a jump far ahead.
+#define SYNTAX_UNKNOWN 0xff
+
+// A line further than this past the known states is not lexed up to from
+// them: lexing starts this many lines before it, as if nothing were open.
+#define SYNTAX_SYNC 10000
+
+// C lines end in code, in a block comment, in a string or directive
+// continued with a backslash.
+enum { C_CODE, C_COMMENT, C_STRING, C_PREPROC };
+
+// Log lines end in a record of this level; indented lines after it (a
+// stack trace) belong to it.
+enum { LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO };
+
+// One line being lexed. Classes are only written for bytes [from, to),
+// and not at all without cls.
+typedef struct {
+    const unsigned char *p;
+    size_t n;
+    unsigned char *cls;
+    size_t from, to;
+} Lex;
+
+static const char *const c_keywords[] = {
+    "auto", "break", "case", "const", "continue", "default", "do", "else", "enum", "extern",
+    "for", "goto", "if", "inline", "register", "restrict", "return", "sizeof", "static",
+    "struct", "switch", "typedef", "union", "volatile", "while", "_Alignas", "_Alignof",
+    "_Atomic", "_Generic", "_Noreturn", "_Static_assert", "_Thread_local", NULL,
+};
+
+static const char *const c_types[] = {
+    "bool", "char", "double", "float", "int", "long", "short", "signed", "unsigned", "void",
+    "_Bool", "_Complex", NULL,
+};
+
+static const char *const c_literals[] = { "NULL", "true", "false", NULL };
+
+static const char *const log_levels[][8] = {
+    [LOG_ERROR] = { "ERROR", "ERR", "FATAL", "CRITICAL", "CRIT", "SEVERE", "PANIC", NULL },
+    [LOG_WARN] = { "WARN", "WARNING", NULL },
+    [LOG_INFO] = { "INFO", "NOTICE", "DEBUG", "TRACE", NULL },
+};
+
+SyntaxLang syntax_lang(const char *filename) {
+    const char *dot = filename ? strrchr(filename, '.') : NULL;
+    if (!dot || strchr(dot, '/')) return SYNTAX_NONE;
+    static const char *const c_ext[] = { ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", NULL };
+    for (const char *const *e = c_ext; *e; e++) {
+        if (strcmp(dot, *e) == 0) return SYNTAX_C;
+    }
+    if (strcmp(dot, ".json") == 0) return SYNTAX_JSON;
+    if (strcmp(dot, ".log") == 0) return SYNTAX_LOG;
+    return SYNTAX_NONE;
+}
+
+static bool is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool is_alpha(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool is_word(unsigned char c) {
+    return is_alpha(c) || is_digit(c) || c == '_';
+}
+
+static bool in_list(const char *const *list, const unsigned char *w, size_t n, bool nocase) {
+    for (; *list; list++) {
+        if (strlen(*list) != n) continue;
+        if (nocase ? strncasecmp(*list, (const char *)w, n) == 0 : memcmp(*list, w, n) == 0) return true;
+    }
+    return false;
+}
+
+static void paint(Lex *L, size_t a, size_t b, int c) {
+    if (!L->cls) return;
+    if (a < L->from) a = L->from;
+    if (b > L->to) b = L->to;
+    if (a < b) memset(L->cls + (a - L->from), c, b - a);
+}
+
+// Past the quote closing the literal whose body starts at i, or the end of
+// the line. *cont is set if the line ends in it with a backslash.
+static size_t quoted(const Lex *L, size_t i, unsigned char q, bool *cont) {
+    *cont = false;
+    while (i < L->n) {
+        if (L->p[i] == '\\') {
+            if (i + 1 == L->n) *cont = true;
+            i += 2;
+            continue;
+        }
+        if (L->p[i++] == q) return i;
+    }
+    return L->n;
+}
+
+// Past the "*/" that closes a comment, looking from i; 0 if there is none.
+static size_t comment_end(const Lex *L, size_t i) {
+    for (; i + 1 < L->n; i++) {
+        if (L->p[i] == '*' && L->p[i + 1] == '/') return i + 2;
+    }
+    return 0;
+}
+
+static int lex_c(Lex *L, int st) {
+    const unsigned char *p = L->p;
+    size_t n = L->n, i = 0;
+    bool cont;
+    if (st == C_COMMENT) {
+        i = comment_end(L, 0);
+        if (!i) {
+            paint(L, 0, n, SYN_COMMENT);
+            return C_COMMENT;
+        }
+        paint(L, 0, i, SYN_COMMENT);
+    } else if (st == C_STRING) {
+        i = quoted(L, 0, '"', &cont);
+        paint(L, 0, i, SYN_STRING);
+        if (cont) return C_STRING;
+    }
+
+    // a directive, or the continuation of one, shows as such throughout
+    bool directive = st == C_PREPROC;
+    if (st == C_CODE) {
+        size_t k = 0;
+        while (k < n && (p[k] == ' ' || p[k] == '\t')) k++;
+        directive = k < n && p[k] == '#';
+    }
+    paint(L, i, n, directive ? SYN_PREPROC : SYN_PLAIN);
+
+    while (i < n) {
+        unsigned char c = p[i];
+        if (c == '/' && i + 1 < n && p[i + 1] == '/') {
+            paint(L, i, n, SYN_COMMENT);
+            return C_CODE;
+        }
+        if (c == '/' && i + 1 < n && p[i + 1] == '*') {
+            size_t e = comment_end(L, i + 2);
+            paint(L, i, e ? e : n, SYN_COMMENT);
+            if (!e) return C_COMMENT;
+            i = e;
+        } else if (c == '"' || c == '\'') {
+            size_t e = quoted(L, i + 1, c, &cont);
+            paint(L, i, e, SYN_STRING);
+            if (cont && c == '"') return C_STRING;
+            i = e;
+        } else if (is_digit(c) || (c == '.' && i + 1 < n && is_digit(p[i + 1]))) {
+            size_t e = i + 1;
+            while (e < n && (is_word(p[e]) || p[e] == '.' ||
+                             ((p[e] == '+' || p[e] == '-') && strchr("eEpP", p[e - 1])))) {
+                e++;
+            }
+            if (!directive) paint(L, i, e, SYN_NUMBER);
+            i = e;
+        } else if (is_word(c)) {
+            size_t e = i;
+            while (e < n && is_word(p[e])) e++;
+            if (!directive) {
+                const unsigned char *w = p + i;
+                size_t k = e - i;
+                if (in_list(c_keywords, w, k, false)) paint(L, i, e, SYN_KEYWORD);
+                else if (in_list(c_types, w, k, false) || (k > 2 && w[k - 2] == '_' && w[k - 1] == 't')) paint(L, i, e, SYN_TYPE);
+                else if (in_list(c_literals, w, k, false)) paint(L, i, e, SYN_LITERAL);
+            }
+            i = e;
+        } else {
+            i++;
+        }
+    }
+    return directive && n && p[n - 1] == '\\' ? C_PREPROC : C_CODE;
+}
+
+// JSON strings cannot span lines, so every line starts afresh. A string is
+// a member name when a ':' follows it.
+static int lex_json(Lex *L) {
+    const unsigned char *p = L->p;
+    size_t n = L->n, i = 0;
+    bool cont;
+    paint(L, 0, n, SYN_PLAIN);
+    while (i < n) {
+        unsigned char c = p[i];
+        if (c == '"') {
+            size_t e = quoted(L, i + 1, '"', &cont), k = e;
+            while (k < n && (p[k] == ' ' || p[k] == '\t')) k++;
+            paint(L, i, e, k < n && p[k] == ':' ? SYN_KEY : SYN_STRING);
+            i = e;
+        } else if (c == '-' || is_digit(c)) {
+            size_t e = i + 1;
+            while (e < n && (is_digit(p[e]) || p[e] == '.' || p[e] == 'e' || p[e] == 'E' || p[e] == '+' || p[e] == '-')) e++;
+            paint(L, i, e, SYN_NUMBER);
+            i = e;
+        } else if (is_alpha(c)) {
+            size_t e = i;
+            while (e < n && is_alpha(p[e])) e++;
+            static const char *const lits[] = { "true", "false", "null", NULL };
+            if (in_list(lits, p + i, e - i, false)) paint(L, i, e, SYN_LITERAL);
+            i = e;
+        } else {
+            i++;
+        }
+    }
+    return 0;
+}
+
+// A log line: a leading timestamp, the level of its record somewhere in
+// the first words, and quoted strings. An indented line goes on the
+// record before it and takes its color when that is an error or warning.
+static int lex_log(Lex *L, int st) {
+    const unsigned char *p = L->p;
+    size_t n = L->n, i = 0;
+    bool cont;
+    if (n && (p[0] == ' ' || p[0] == '\t')) {
+        paint(L, 0, n, st == LOG_ERROR ? SYN_ERROR : st == LOG_WARN ? SYN_WARN : SYN_PLAIN);
+        return st;
+    }
+    paint(L, 0, n, SYN_PLAIN);
+
+    // digits and the separators of dates and times, with 'T' or a space
+    // only between digits
+    if (i < n && p[i] == '[') i++;
+    size_t t0 = i;
+    while (i < n && (is_digit(p[i]) || (p[i] && strchr("-:/.,+", p[i])) ||
+                     ((p[i] == 'T' || p[i] == ' ') && i > t0 && is_digit(p[i - 1]) && i + 1 < n && is_digit(p[i + 1])))) {
+        i++;
+    }
+    if (i > t0 && is_digit(p[t0])) paint(L, t0, i, SYN_NUMBER);
+
+    int level = LOG_NONE;
+    for (int words = 0; i < n; ) {
+        unsigned char c = p[i];
+        if (c == '"') {
+            size_t e = quoted(L, i + 1, '"', &cont);
+            paint(L, i, e, SYN_STRING);
+            i = e;
+        } else if (is_word(c)) {
+            size_t e = i;
+            while (e < n && is_word(p[e])) e++;
+            if (level == LOG_NONE && words++ < 8) {
+                for (int lv = LOG_ERROR; lv <= LOG_INFO; lv++) {
+                    if (!in_list(log_levels[lv], p + i, e - i, true)) continue;
+                    level = lv;
+                    paint(L, i, e, lv == LOG_ERROR ? SYN_ERROR : lv == LOG_WARN ? SYN_WARN : SYN_INFO);
+                    break;
+                }
+            }
+            i = e;
+        } else {
+            i++;
+        }
+    }
+    return level;
+}
+
+static int lex_line(Syntax *S, const Line *ln, int st, size_t from, size_t to, unsigned char *cls) {
+    Lex L = { .p = (const unsigned char *)"", .n = ln->len, .cls = cls, .from = from, .to = to };
+    if (ln->gaplen) {
+        if (ln->len > S->rowcap) {
+            S->rowcap = ln->len * 2;
+            S->row = xrealloc(S->row, S->rowcap);
+        }
+        for (size_t x = 0, k; x < ln->len; x += k) {
+            const char *q = line_peek(ln, x, &k);
+            memcpy(S->row + x, q, k);
+        }
+        L.p = (const unsigned char *)S->row;
+    } else if (ln->len) {
+        L.p = (const unsigned char *)ln->data;
+    }
+    if (st == SYNTAX_UNKNOWN) st = 0;
+    switch (S->lang) {
+        case SYNTAX_C: return lex_c(&L, st);
+        case SYNTAX_JSON: return lex_json(&L);
+        case SYNTAX_LOG: return lex_log(&L, st);
+        default: return 0;
+    }
+}
+
+void syntax_init(Syntax *S, SyntaxLang lang) {
+    memset(S, 0, sizeof(*S));
+    S->lang = lang;
+    S->lo = SIZE_MAX;
+}
+
+void syntax_free(Syntax *S) {
+    free(S->state);
+    free(S->row);
+    syntax_init(S, S->lang);
+}
+
+static void syntax_reserve(Syntax *S, size_t n) {
+    if (n <= S->cap) return;
+    S->cap = n > S->cap * 2 ? n : S->cap * 2;
+    S->state = xrealloc(S->state, S->cap);
+}
+
+static void syntax_clean(Syntax *S) {
+    S->lo = SIZE_MAX;
+    S->hi = 0;
+}
+
+// Line y, which is at most one past the known ones, ends in state st.
+static void syntax_store(Syntax *S, size_t y, int st) {
+    if (y == S->valid) {
+        syntax_reserve(S, y + 1);
+        S->state[S->valid++] = (unsigned char)st;
+        if (S->lo <= y) syntax_clean(S);
+        return;
+    }
+    int old = S->state[y];
+    S->state[y] = (unsigned char)st;
+    if (S->lo == y) {
+        // past the changed lines, relexing ends where a state holds
+        S->lo = y + 1;
+        if ((S->lo >= S->hi && st == old) || S->lo >= S->valid) syntax_clean(S);
+    } else if (st != old && S->lo > y + 1) {
+        S->lo = y + 1;
+    }
+}
+
+void syntax_edit(Syntax *S, size_t y, size_t removed, size_t added) {
+    if (S->lang == SYNTAX_NONE || y >= S->valid) return;
+    // The states of the lines after the edit move with them. Its last line
+    // ends where the last line it replaced did, so that is the state the
+    // relexing compares with.
+    size_t tail = y + 1 + removed;
+    if (tail >= S->valid) {
+        S->valid = y + 1;
+    } else {
+        unsigned char last = S->state[tail - 1];
+        size_t n = S->valid - tail;
+        syntax_reserve(S, y + 1 + added + n);
+        memmove(S->state + y + 1 + added, S->state + tail, n);
+        memset(S->state + y, SYNTAX_UNKNOWN, added);
+        S->state[y + added] = last;
+        S->valid = y + 1 + added + n;
+    }
+    if (S->hi > tail) S->hi = S->hi - removed + added;
+    if (S->hi < y + 1 + added) S->hi = y + 1 + added;
+    if (S->lo > y) S->lo = y;
+}
+
+// Bring the end states of lines [0, y) up to date.
+static void syntax_ensure(Syntax *S, Buffer *B, size_t y) {
+    size_t nlines = buffer_nlines(B);
+    if (y > nlines) y = nlines;
+    size_t k = S->lo < S->valid ? S->lo : S->valid;
+    if (y > k + SYNTAX_SYNC) {
+        // too far to lex up to: forget what lies between
+        size_t skip = y - SYNTAX_SYNC;
+        syntax_reserve(S, skip);
+        memset(S->state + k, SYNTAX_UNKNOWN, skip - k);
+        if (S->valid < skip) S->valid = skip;
+        if (S->lo < skip) S->lo = skip;
+        k = skip;
+    }
+    if (k >= y) {
+        // lines skipped by a jump: start a little way back
+        k = y;
+        while (k > 0 && y - k < SYNTAX_SYNC && S->state[k - 1] == SYNTAX_UNKNOWN) k--;
+    }
+    if (k >= y) return;
+
+    LtIter it;
+    buffer_iter(B, k, &it);
+    for (; k < y; k++) {
+        syntax_store(S, k, lex_line(S, buffer_iter_next(&it), k ? S->state[k - 1] : 0, 0, 0, NULL));
+        // the rest up to y is known and holds
+        if (k + 1 < S->valid && S->lo > k + 1) break;
+    }
+}
+
+bool syntax_stale(Syntax *S, Buffer *B, size_t y) {
+    if (S->lang == SYNTAX_NONE) return false;
+    syntax_ensure(S, B, y);
+    return S->lo <= y;
+}
+
+void syntax_line(Syntax *S, Buffer *B, size_t y, size_t from, size_t to, unsigned char *cls) {
+    if (to > from) memset(cls, SYN_PLAIN, to - from);
+    if (S->lang == SYNTAX_NONE) return;
+    syntax_ensure(S, B, y);
+    syntax_store(S, y, lex_line(S, buffer_line(B, y), y ? S->state[y - 1] : 0, from, to, cls));
+}
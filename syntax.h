@@ -0,0 +1,64 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buffer.h"
+
+// Syntax highlighting for C, JSON and log files. How a line is colored
+// can depend on the lines before it (a comment left open, the level of
+// the log record a stack trace belongs to), so the lexer state at the end
+// of every line is kept once found. Lines are only lexed when they are
+// drawn or lead up to one that is, and after an edit the relexing stops
+// at the first line whose end state comes out as before.
+typedef enum {
+    SYNTAX_NONE,
+    SYNTAX_C,
+    SYNTAX_JSON,
+    SYNTAX_LOG,
+} SyntaxLang;
+
+// What a byte is, for choosing its color.
+enum {
+    SYN_PLAIN,
+    SYN_COMMENT,
+    SYN_KEYWORD,
+    SYN_TYPE,
+    SYN_STRING,
+    SYN_NUMBER,
+    SYN_PREPROC,
+    SYN_KEY,     // JSON member name
+    SYN_LITERAL, // true, false, null
+    SYN_ERROR,   // log levels
+    SYN_WARN,
+    SYN_INFO,
+};
+
+typedef struct {
+    SyntaxLang lang;
+    unsigned char *state; // end state of lines [0, valid)
+    size_t valid, cap;
+    size_t lo, hi;        // relex from lo; past hi, only until a state holds
+    char *row;            // copy of a line that has a gap
+    size_t rowcap;
+} Syntax;
+
+// The language for a file name, by its extension.
+SyntaxLang syntax_lang(const char *filename);
+
+void syntax_init(Syntax *S, SyntaxLang lang);
+void syntax_free(Syntax *S);
+
+// Line y changed, and the `removed` lines after it were replaced by
+// `added` new ones.
+void syntax_edit(Syntax *S, size_t y, size_t removed, size_t added);
+
+// Whether line y may have to be drawn differently although it did not
+// change, because the state it starts in did.
+bool syntax_stale(Syntax *S, Buffer *B, size_t y);
+
+// The classes of bytes [from, to) of line y, in cls[0 .. to - from).
+void syntax_line(Syntax *S, Buffer *B, size_t y, size_t from, size_t to, unsigned char *cls);
+
+#endif
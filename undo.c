@@ -0,0 +1,223 @@
+#include "undo.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define UNDO_SLAB_SIZE 65536
+
+// A step stops taking in keystrokes once it holds this many bytes.
+#define UNDO_MERGE_MAX 4096
+
+void undo_init(Undo *U, size_t limit) {
+    memset(U, 0, sizeof(*U));
+    U->limit = limit;
+    U->sealed = true;
+    arena_init(&U->text, UNDO_SLAB_SIZE);
+}
+
+void undo_free(Undo *U) {
+    for (size_t i = 0; i < U->nsteps; i++) free(U->steps[i].spans);
+    arena_free(&U->text);
+    free(U->steps);
+    free(U->scratch);
+    memset(U, 0, sizeof(*U));
+}
+
+// The position just after n bytes of text placed at (y, x).
+static void text_end(size_t y, size_t x, const char *s, size_t n, size_t *ey, size_t *ex) {
+    const char *p = s, *end = s + n, *nl;
+    while ((nl = memchr(p, '\n', (size_t)(end - p)))) {
+        y++;
+        x = 0;
+        p = nl + 1;
+    }
+    *ey = y;
+    *ex = x + (size_t)(end - p);
+}
+
+size_t undo_bytes(const Undo *U) {
+    return U->text.used - U->text.dead + U->nsteps * sizeof(UndoStep) + U->nspans * sizeof(UndoSpan);
+}
+
+static size_t step_bytes(const UndoStep *st) {
+    return st->n + sizeof(UndoStep) + st->nspans * sizeof(UndoSpan);
+}
+
+static void step_drop(Undo *U, UndoStep *st) {
+    arena_release(&U->text, st->n);
+    free(st->spans);
+    U->nspans -= st->nspans;
+}
+
+// Move the live text to a fresh arena once most of the old one is dead.
+static void undo_compact(Undo *U) {
+    Arena fresh;
+    arena_init(&fresh, UNDO_SLAB_SIZE);
+    for (size_t i = 0; i < U->nsteps; i++) {
+        U->steps[i].text = arena_dup(&fresh, U->steps[i].text, U->steps[i].n);
+    }
+    arena_free(&U->text);
+    U->text = fresh;
+}
+
+// Over the limit, forget the oldest steps down to 3/4 of it, so that the
+// next few edits do not have to trim again.
+static void undo_trim(Undo *U) {
+    size_t bytes = undo_bytes(U);
+    if (bytes <= U->limit) return;
+    size_t drop = 0;
+    while (drop < U->nundo && bytes > U->limit / 4 * 3) {
+        bytes -= step_bytes(&U->steps[drop]);
+        step_drop(U, &U->steps[drop]);
+        drop++;
+    }
+    memmove(U->steps, U->steps + drop, (U->nsteps - drop) * sizeof(UndoStep));
+    U->nsteps -= drop;
+    U->nundo -= drop;
+    if (!U->nundo) U->sealed = true;
+    if (U->text.dead > U->text.used / 2) undo_compact(U);
+}
+
+static UndoStep *undo_push(Undo *U, UndoKind kind, size_t y, size_t x, const char *s, size_t n) {
+    // a new edit ends the redo history
+    for (size_t i = U->nundo; i < U->nsteps; i++) step_drop(U, &U->steps[i]);
+    U->nsteps = U->nundo;
+    if (U->nsteps == U->cap) {
+        U->cap = U->cap ? U->cap * 2 : 64;
+        U->steps = xrealloc(U->steps, U->cap * sizeof(UndoStep));
+    }
+    UndoStep *st = &U->steps[U->nsteps++];
+    U->nundo = U->nsteps;
+    st->kind = (unsigned char)kind;
+    st->back = false;
+    st->y = y;
+    st->x = x;
+    text_end(y, x, s, n, &st->ey, &st->ex);
+    st->text = arena_dup(&U->text, s, n);
+    st->n = n;
+    st->spans = NULL;
+    st->nspans = 0;
+    // a paste or block edit is a step of its own
+    U->sealed = n > 1;
+    return st;
+}
+
+// The newest step, if the next keystroke may extend it.
+static UndoStep *undo_open(Undo *U, UndoKind kind) {
+    if (U->sealed || !U->nundo || U->nundo != U->nsteps) return NULL;
+    UndoStep *st = &U->steps[U->nundo - 1];
+    return st->kind == kind && st->n < UNDO_MERGE_MAX ? st : NULL;
+}
+
+static void undo_append(Undo *U, UndoStep *st, char c) {
+    st->text = arena_grow(&U->text, st->text, st->n, 1);
+    st->text[st->n++] = c;
+}
+
+void undo_insert(Undo *U, size_t y, size_t x, const char *s, size_t n) {
+    if (!n) return;
+    UndoStep *st = n == 1 ? undo_open(U, UNDO_INSERT) : NULL;
+    // typing on where the step ends; a newline ends the step after it
+    if (st && st->ey == y && st->ex == x && st->text[st->n - 1] != '\n') {
+        undo_append(U, st, *s);
+        text_end(y, x, s, 1, &st->ey, &st->ex);
+    } else {
+        undo_push(U, UNDO_INSERT, y, x, s, n);
+    }
+    undo_trim(U);
+}
+
+void undo_delete(Undo *U, size_t y, size_t x, const char *s, size_t n, bool back) {
+    if (!n) return;
+    UndoStep *st = n == 1 ? undo_open(U, UNDO_DELETE) : NULL;
+    size_t ey, ex;
+    text_end(y, x, s, n, &ey, &ex);
+    if (st && !back && !st->back && st->y == y && st->x == x) {
+        // Delete again at the same place: the text grows at its end
+        undo_append(U, st, *s);
+        text_end(st->ey, st->ex, s, 1, &st->ey, &st->ex);
+    } else if (st && back && st->back && st->y == ey && st->x == ex) {
+        // Backspace again: the text grows at its start
+        undo_append(U, st, *s);
+        st->y = y;
+        st->x = x;
+    } else {
+        st = undo_push(U, UNDO_DELETE, y, x, s, n);
+        st->back = back && n == 1;
+    }
+    undo_trim(U);
+}
+
+bool undo_replace(Undo *U, const BufferEdit *e, size_t n, const char *old) {
+    if (!n) return true;
+    size_t nold = 0, nnew = 0;
+    for (size_t i = 0; i < n; i++) {
+        nold += e[i].n;
+        nnew += e[i].slen;
+    }
+    UndoStep *st = undo_push(U, UNDO_REPLACE, e[0].y, e[0].x, old, nold);
+    st->ey = st->y;
+    st->ex = st->x;
+    st->text = arena_grow(&U->text, st->text, nold, nnew);
+    char *p = st->text + nold;
+    for (size_t i = 0; i < n; i++) {
+        if (e[i].slen) memcpy(p, e[i].s, e[i].slen);
+        p += e[i].slen;
+    }
+    st->n = nold + nnew;
+    st->spans = xmalloc(n * sizeof(UndoSpan));
+    for (size_t i = 0; i < n; i++) st->spans[i] = (UndoSpan){ e[i].y, e[i].x, e[i].n, e[i].slen };
+    st->nspans = n;
+    U->nspans += n;
+    U->sealed = true;
+    undo_trim(U);
+    // the step is the newest, so it is gone only if everything is
+    return U->nundo > 0;
+}
+
+void undo_spans(const UndoStep *st, bool back, BufferEdit *e) {
+    size_t nold = 0;
+    for (size_t i = 0; i < st->nspans; i++) nold += st->spans[i].n;
+    const char *o = st->text, *w = st->text + nold;
+    // Reversed, a span sits where the spans before it on its line left it
+    size_t y = SIZE_MAX, shift = 0;
+    for (size_t i = 0; i < st->nspans; i++) {
+        const UndoSpan *sp = &st->spans[i];
+        if (sp->y != y) {
+            y = sp->y;
+            shift = 0;
+        }
+        if (back) e[i] = (BufferEdit){ sp->y, sp->x + shift, sp->slen, o, sp->n };
+        else e[i] = (BufferEdit){ sp->y, sp->x, sp->n, w, sp->slen };
+        shift += sp->slen - sp->n;
+        o += sp->n;
+        w += sp->slen;
+    }
+}
+
+void undo_seal(Undo *U) {
+    U->sealed = true;
+}
+
+const UndoStep *undo_undo(Undo *U) {
+    U->sealed = true;
+    return U->nundo ? &U->steps[--U->nundo] : NULL;
+}
+
+const UndoStep *undo_redo(Undo *U) {
+    U->sealed = true;
+    return U->nundo < U->nsteps ? &U->steps[U->nundo++] : NULL;
+}
+
+const char *undo_text(Undo *U, const UndoStep *st) {
+    if (!st->back) return st->text;
+    if (st->n > U->nscratch) {
+        U->nscratch = st->n;
+        U->scratch = xrealloc(U->scratch, U->nscratch);
+    }
+    for (size_t i = 0; i < st->n; i++) U->scratch[i] = st->text[st->n - 1 - i];
+    return U->scratch;
+}
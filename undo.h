@@ -0,0 +1,78 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "buffer.h"
+
+// Undo/redo history as a log of edits. Each step is one insert or delete
+// of a run of text at a position; its bytes live in the history's arena.
+// Keystrokes that continue the previous step (typing on, deleting on with
+// Delete or Backspace) extend it instead of adding another, and a paste or
+// block edit is a single step however many lines it spans. A replace of
+// many spans at once (see buffer_replace_spans()) is a step as well.
+typedef enum {
+    UNDO_INSERT,
+    UNDO_DELETE,
+    UNDO_REPLACE,
+} UndoKind;
+
+// One span of an UNDO_REPLACE step, at its position before the replace:
+// n bytes that became slen bytes.
+typedef struct {
+    size_t y, x, n, slen;
+} UndoSpan;
+
+typedef struct {
+    unsigned char kind;
+    bool back;     // Backspace run: bytes stored last-deleted first
+    size_t y, x;   // where the text starts
+    size_t ey, ex; // where it ends
+    char *text;    // UNDO_REPLACE: the old bytes of every span, then the new
+    size_t n;
+    UndoSpan *spans;
+    size_t nspans;
+} UndoStep;
+
+// Steps [0, nundo) can be undone, the most recent last; steps [nundo,
+// nsteps) were undone and can be redone. When the history takes more than
+// limit bytes the oldest steps are forgotten.
+typedef struct {
+    UndoStep *steps;
+    size_t nsteps, nundo, cap;
+    bool sealed; // the next edit starts a new step
+    Arena text;
+    size_t nspans; // held by all the steps
+    size_t limit;
+    char *scratch; // text of a Backspace run put back in order
+    size_t nscratch;
+} Undo;
+
+void undo_init(Undo *U, size_t limit);
+void undo_free(Undo *U);
+
+// Record an edit that was just made. Recording drops the redo steps.
+void undo_insert(Undo *U, size_t y, size_t x, const char *s, size_t n);
+void undo_delete(Undo *U, size_t y, size_t x, const char *s, size_t n, bool back);
+// Record a replace about to be made: e[i] is a span and its new text, and
+// old holds the current bytes of all the spans in order. Returns false if
+// the step alone is over the limit and could not be kept.
+bool undo_replace(Undo *U, const BufferEdit *e, size_t n, const char *old);
+
+// The next edit starts a new step even if it continues this one.
+void undo_seal(Undo *U);
+
+// The step to reverse for an undo or to apply again for a redo, or NULL.
+// undo_text() gives its bytes in document order.
+const UndoStep *undo_undo(Undo *U);
+const UndoStep *undo_redo(Undo *U);
+const char *undo_text(Undo *U, const UndoStep *st);
+// The spans that make an UNDO_REPLACE step (or with back, reverse it), in
+// e[0..st->nspans).
+void undo_spans(const UndoStep *st, bool back, BufferEdit *e);
+
+size_t undo_bytes(const Undo *U);
+
+#endif
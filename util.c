@@ -2,13 +2,14 @@
 #include "util.h"
 
 #include <errno.h>
-#include <ncurses.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "screen.h"
+
 void die(const char *what) {
-    endwin();
+    screen_end();
     fprintf(stderr, "%s: %s\n", what, strerror(errno));
     exit(1);
 }
@@ -0,0 +1,461 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vt.h"
+
+#include <errno.h>
+#include <ncurses.h> // KEY_* codes only
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "screen.h"
+#include "util.h"
+#include "width.h"
+
+// How long to wait for the rest of an escape sequence before taking a
+// lone ESC as the Escape key.
+#define VT_ESC_MS 25
+
+// Unchanged cells between two changed ones are rewritten rather than
+// skipped with a cursor move when there are at most this many.
+#define VT_BRIDGE 4
+
+// How long a paste may pause before what arrived so far is taken as all of it.
+#define VT_PASTE_MS 1000
+
+// Cell attributes: reverse video, and the text color in the bits above.
+#define VT_REVERSE     1
+#define VT_COLOR_SHIFT 1
+#define VT_COLOR_MASK  (7 << VT_COLOR_SHIFT)
+
+// A double-width character fills its cell and the next, which is left
+// empty (len 0) as its continuation.
+typedef struct {
+    char ch[4]; // UTF-8 bytes
+    unsigned char len;
+    unsigned char attr;
+    bool wide;
+} Cell;
+
+static const Cell blank = { .ch = " ", .len = 1, .attr = 0 };
+
+static struct {
+    bool active;
+    struct termios saved;
+
+    int rows, cols;
+    Cell *front; // what the terminal shows
+    Cell *back;  // what the next frame should show
+    int y, x;    // drawing position in back
+    unsigned char attr;
+
+    int ty, tx; // terminal cursor; -1 when unknown
+    unsigned char tattr;
+
+    char *out;
+    size_t nout, capout;
+
+    unsigned char in[4096]; // input not yet decoded
+    size_t nin;
+
+    char *paste; // text of the last bracketed paste
+    size_t npaste, cappaste;
+} vt;
+
+static volatile sig_atomic_t vt_resized;
+
+static void on_winch(int sig) {
+    (void)sig;
+    vt_resized = 1;
+}
+
+static void out_put(const char *s, size_t n) {
+    if (vt.nout + n > vt.capout) {
+        vt.capout = (vt.nout + n) * 2;
+        vt.out = xrealloc(vt.out, vt.capout);
+    }
+    memcpy(vt.out + vt.nout, s, n);
+    vt.nout += n;
+}
+
+static void out_str(const char *s) {
+    out_put(s, strlen(s));
+}
+
+static void out_flush(void) {
+    size_t off = 0;
+    while (off < vt.nout) {
+        ssize_t w = write(STDOUT_FILENO, vt.out + off, vt.nout - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+    vt.nout = 0;
+}
+
+void vt_size(int *rows, int *cols) {
+    if (vt.active) {
+        *rows = vt.rows;
+        *cols = vt.cols;
+        return;
+    }
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+        *rows = ws.ws_row;
+        *cols = ws.ws_col;
+        return;
+    }
+    const char *l = getenv("LINES"), *c = getenv("COLUMNS");
+    *rows = l && atoi(l) > 0 ? atoi(l) : 24;
+    *cols = c && atoi(c) > 0 ? atoi(c) : 80;
+}
+
+// (Re)size the grids to the terminal and clear it; the next refresh then
+// only has to draw what is not blank.
+static void vt_reset(void) {
+    vt.active = false;
+    vt_size(&vt.rows, &vt.cols);
+    vt.active = true;
+    size_t n = (size_t)vt.rows * (size_t)vt.cols;
+    vt.front = xrealloc(vt.front, n * sizeof(Cell));
+    vt.back = xrealloc(vt.back, n * sizeof(Cell));
+    for (size_t i = 0; i < n; i++) vt.front[i] = vt.back[i] = blank;
+    vt.y = vt.x = 0;
+    out_str("\x1b[m\x1b[H\x1b[2J");
+    vt.ty = vt.tx = 0;
+    vt.tattr = 0;
+}
+
+void vt_init(void) {
+    tcgetattr(STDIN_FILENO, &vt.saved);
+    struct termios t = vt.saved;
+    t.c_iflag &= ~(tcflag_t)(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    t.c_oflag &= ~(tcflag_t)OPOST;
+    t.c_lflag &= ~(tcflag_t)(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    t.c_cflag &= ~(tcflag_t)(CSIZE | PARENB);
+    t.c_cflag |= CS8;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &t);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_winch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL); // no SA_RESTART: poll() must see EINTR
+
+    // alternate screen, application cursor keys, bracketed paste
+    out_str("\x1b[?1049h\x1b[?1h\x1b=\x1b[?2004h");
+    vt_reset();
+    out_flush();
+}
+
+void vt_end(void) {
+    if (!vt.active) return;
+    out_str("\x1b[m\x1b[?2004l\x1b[?1l\x1b>\x1b[?1049l");
+    out_flush();
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &vt.saved);
+    vt.active = false;
+    free(vt.front);
+    free(vt.back);
+    free(vt.out);
+    free(vt.paste);
+    vt.front = vt.back = NULL;
+    vt.out = vt.paste = NULL;
+    vt.capout = vt.cappaste = vt.npaste = 0;
+}
+
+void vt_move(int y, int x) {
+    vt.y = y < 0 ? 0 : y >= vt.rows ? vt.rows - 1 : y;
+    vt.x = x < 0 ? 0 : x >= vt.cols ? vt.cols - 1 : x;
+}
+
+void vt_clrtoeol(void) {
+    Cell *row = vt.back + (size_t)vt.y * (size_t)vt.cols;
+    for (int x = vt.x; x < vt.cols; x++) row[x] = blank;
+}
+
+static void put_cell(const char *s, int n, bool wide) {
+    if (vt.x >= vt.cols) return;
+    Cell *row = vt.back + (size_t)vt.y * (size_t)vt.cols, *c = &row[vt.x];
+    // half of a double-width character cannot stay on its own
+    if (n && !c->len && vt.x > 0) row[vt.x - 1] = blank;
+    if (n && c->wide && vt.x + 1 < vt.cols) row[vt.x + 1] = blank;
+    memcpy(c->ch, s, (size_t)n);
+    c->len = (unsigned char)n;
+    c->attr = vt.attr;
+    c->wide = wide;
+    vt.x++;
+}
+
+// Characters look as width_char() says, like the text area: tabs expand,
+// control characters show as ^X and what does not decode as '?'. A wide
+// character with only one column left shows as a blank. Text is clipped
+// at the right edge.
+void vt_addnstr(const char *s, int n) {
+    for (int i = 0; i < n && s[i]; ) {
+        char g[WIDTH_GLYPH_MAX];
+        size_t w, k;
+        i += (int)width_char(s + i, (size_t)(n - i), (size_t)vt.x, &w, g, &k);
+        if ((unsigned char)g[0] < 0x80) {
+            for (size_t j = 0; j < k; j++) put_cell(g + j, 1, false);
+        } else if (w == 1) {
+            put_cell(g, (int)k, false);
+        } else if (vt.x + 1 < vt.cols) {
+            put_cell(g, (int)k, true);
+            put_cell("", 0, false);
+        } else {
+            put_cell(" ", 1, false);
+        }
+    }
+}
+
+void vt_reverse(bool on) {
+    vt.attr = (unsigned char)(on ? vt.attr | VT_REVERSE : vt.attr & ~VT_REVERSE);
+}
+
+void vt_color(int c) {
+    vt.attr = (unsigned char)((vt.attr & ~VT_COLOR_MASK) | ((c << VT_COLOR_SHIFT) & VT_COLOR_MASK));
+}
+
+static bool cell_eq(const Cell *a, const Cell *b) {
+    return a->len == b->len && a->attr == b->attr && memcmp(a->ch, b->ch, a->len) == 0;
+}
+
+static void emit_attr(unsigned char attr) {
+    if (attr == vt.tattr) return;
+    char buf[16];
+    int c = (attr & VT_COLOR_MASK) >> VT_COLOR_SHIFT;
+    if (!attr) snprintf(buf, sizeof(buf), "\x1b[m");
+    else if (!c) snprintf(buf, sizeof(buf), "\x1b[0;7m");
+    else snprintf(buf, sizeof(buf), "\x1b[0;%s3%dm", attr & VT_REVERSE ? "7;" : "", c);
+    out_str(buf);
+    vt.tattr = attr;
+}
+
+// Pick the shortest way there: nothing, a relative move on the same row,
+// or an absolute position.
+static void emit_move(int y, int x) {
+    if (vt.ty == y && vt.tx == x) return;
+    char buf[32];
+    if (vt.ty == y && vt.tx >= 0 && x > vt.tx) {
+        if (x - vt.tx == 1) snprintf(buf, sizeof(buf), "\x1b[C");
+        else snprintf(buf, sizeof(buf), "\x1b[%dC", x - vt.tx);
+    } else if (vt.ty == y && vt.tx >= 0 && x == 0) {
+        snprintf(buf, sizeof(buf), "\r");
+    } else if (y == 0 && x == 0) {
+        snprintf(buf, sizeof(buf), "\x1b[H");
+    } else {
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+    }
+    out_str(buf);
+    vt.ty = y;
+    vt.tx = x;
+}
+
+// The continuation of a wide character was written with it.
+static void emit_cell(Cell *front, const Cell *c) {
+    *front = *c;
+    if (!c->len) return;
+    emit_attr(c->attr);
+    out_put(c->ch, c->len);
+    // past the last column the terminal's cursor position is in doubt
+    vt.tx += c->wide ? 2 : 1;
+    if (vt.tx >= vt.cols) vt.ty = vt.tx = -1;
+}
+
+// Move rows [top, top + rows) of grid g up by n (down if n < 0).
+static void shift_rows(Cell *g, int top, int rows, int n) {
+    size_t w = (size_t)vt.cols;
+    int k = n < 0 ? -n : n;
+    Cell *base = g + (size_t)top * w, *gone;
+    if (n > 0) {
+        memmove(base, base + (size_t)k * w, (size_t)(rows - k) * w * sizeof(Cell));
+        gone = base + (size_t)(rows - k) * w;
+    } else {
+        memmove(base + (size_t)k * w, base, (size_t)(rows - k) * w * sizeof(Cell));
+        gone = base;
+    }
+    for (size_t i = 0; i < (size_t)k * w; i++) gone[i] = blank;
+}
+
+// The terminal moves the rows itself (DECSTBM plus SU or SD), so both
+// grids shift with it and only the rows scrolled in differ afterwards.
+void vt_scroll(int top, int rows, int n) {
+    int k = n < 0 ? -n : n;
+    if (!n || top < 0 || rows <= 0 || top + rows > vt.rows) return;
+    if (k >= rows) {
+        for (int y = top; y < top + rows; y++) {
+            vt_move(y, 0);
+            vt_clrtoeol();
+        }
+        return;
+    }
+    shift_rows(vt.front, top, rows, n);
+    shift_rows(vt.back, top, rows, n);
+
+    char buf[48];
+    emit_attr(0); // scrolled-in rows take the current background
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r", top + 1, top + rows, k, n > 0 ? 'S' : 'T');
+    out_str(buf);
+    // setting the region homes the cursor
+    vt.ty = vt.tx = 0;
+}
+
+static void refresh_row(int y) {
+    Cell *b = vt.back + (size_t)y * (size_t)vt.cols;
+    Cell *f = vt.front + (size_t)y * (size_t)vt.cols;
+
+    // from `tail` on the new row is blank: one EL clears it
+    int tail = vt.cols;
+    while (tail > 0 && cell_eq(&b[tail - 1], &blank)) tail--;
+
+    int x = 0;
+    while (x < vt.cols) {
+        if (cell_eq(&b[x], &f[x])) {
+            x++;
+            continue;
+        }
+        emit_move(y, x);
+        if (x >= tail) {
+            emit_attr(0);
+            out_str("\x1b[K");
+            for (; x < vt.cols; x++) f[x] = blank;
+            break;
+        }
+        while (x < tail) {
+            if (!cell_eq(&b[x], &f[x])) {
+                emit_cell(&f[x], &b[x]);
+                x++;
+                continue;
+            }
+            // a short run of unchanged cells in the current attribute is
+            // cheaper to write again than to move over
+            int g = x;
+            while (g < tail && g - x < VT_BRIDGE && cell_eq(&b[g], &f[g]) && b[g].attr == vt.tattr) g++;
+            if (g == tail || g - x == VT_BRIDGE || cell_eq(&b[g], &f[g])) break;
+            for (; x < g; x++) emit_cell(&f[x], &b[x]);
+        }
+    }
+}
+
+void vt_refresh(void) {
+    for (int y = 0; y < vt.rows; y++) refresh_row(y);
+    emit_move(vt.y, vt.x);
+    out_flush();
+}
+
+// Read what is available into vt.in, waiting up to timeout_ms (-1: for
+// ever). Returns false on timeout or interruption.
+static bool vt_fill(int timeout_ms) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+    ssize_t n = read(STDIN_FILENO, vt.in + vt.nin, sizeof(vt.in) - vt.nin);
+    if (n <= 0) return false;
+    vt.nin += (size_t)n;
+    return true;
+}
+
+static int vt_take(size_t n, int key) {
+    memmove(vt.in, vt.in + n, vt.nin - n);
+    vt.nin -= n;
+    return key;
+}
+
+static int csi_key(int param, unsigned char final) {
+    switch (final) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+        switch (param) {
+        case 1: case 7: return KEY_HOME;
+        case 2: return KEY_IC;
+        case 3: return KEY_DC;
+        case 4: case 8: return KEY_END;
+        case 5: return KEY_PPAGE;
+        case 6: return KEY_NPAGE;
+        }
+    }
+    return ERR;
+}
+
+static void paste_add(const unsigned char *p, size_t n) {
+    if (vt.npaste + n > vt.cappaste) {
+        vt.cappaste = (vt.npaste + n) * 2;
+        vt.paste = xrealloc(vt.paste, vt.cappaste);
+    }
+    memcpy(vt.paste + vt.npaste, p, n);
+    vt.npaste += n;
+}
+
+// Take everything up to ESC [ 201 ~ as pasted text.
+static int vt_read_paste(void) {
+    static const char end[] = "\x1b[201~";
+    const size_t nend = sizeof(end) - 1;
+    vt.npaste = 0;
+    for (;;) {
+        // stop at the marker, or at what may be the start of one
+        size_t i = 0;
+        while (i < vt.nin) {
+            unsigned char *e = memchr(vt.in + i, 0x1b, vt.nin - i);
+            if (!e) {
+                i = vt.nin;
+                break;
+            }
+            i = (size_t)(e - vt.in);
+            size_t k = vt.nin - i < nend ? vt.nin - i : nend;
+            if (memcmp(e, end, k) == 0) break;
+            i++;
+        }
+        paste_add(vt.in, i);
+        vt_take(i, 0);
+        if (vt.nin >= nend) return vt_take(nend, SCREEN_PASTE);
+        if (!vt_fill(VT_PASTE_MS)) return vt_take(vt.nin, SCREEN_PASTE);
+    }
+}
+
+char *vt_paste(size_t *len) {
+    *len = vt.npaste;
+    return vt.paste;
+}
+
+// Decode one key from the front of vt.in: a byte, or an escape sequence
+// (CSI or SS3) mapped to a KEY_* code. Unknown sequences are dropped.
+static int vt_decode(void) {
+    if (vt.in[0] != 0x1b) return vt_take(1, vt.in[0]);
+    if (vt.nin == 1 && !vt_fill(VT_ESC_MS)) return vt_take(1, 0x1b);
+    if (vt.in[1] != '[' && vt.in[1] != 'O') return vt_take(1, 0x1b);
+
+    size_t i = 2;
+    for (;;) {
+        while (i < vt.nin && ((vt.in[i] >= '0' && vt.in[i] <= '9') || vt.in[i] == ';')) i++;
+        if (i < vt.nin) break;
+        if (vt.nin == sizeof(vt.in) || !vt_fill(VT_ESC_MS)) return vt_take(vt.nin, ERR);
+    }
+    int param = atoi((const char *)vt.in + 2);
+    unsigned char final = vt.in[i];
+    vt_take(i + 1, 0);
+    if (param == 200 && final == '~') return vt_read_paste();
+    return csi_key(param, final);
+}
+
+int vt_getch(int timeout_ms) {
+    if (!vt.nin) {
+        bool got = vt_fill(timeout_ms);
+        if (vt_resized) {
+            vt_resized = 0;
+            vt_reset();
+            return KEY_RESIZE;
+        }
+        if (!got) return ERR;
+    }
+    return vt_decode();
+}
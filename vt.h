@@ -0,0 +1,26 @@
+#ifndef VT_H
+#define VT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Direct VT100/xterm renderer. Drawing goes to a back grid of cells;
+// vt_refresh() diffs it against the front grid (what the terminal shows)
+// and sends the difference, cursor moves and SGR changes included, in a
+// single write(). Input is read raw from stdin and decoded here.
+void vt_init(void);
+void vt_end(void);
+
+void vt_size(int *rows, int *cols);
+void vt_move(int y, int x);
+void vt_clrtoeol(void);
+void vt_addnstr(const char *s, int n);
+void vt_reverse(bool on);
+void vt_color(int c); // 0 default, else SGR 30 + c
+void vt_scroll(int top, int rows, int n);
+void vt_refresh(void);
+
+int  vt_getch(int timeout_ms);
+char *vt_paste(size_t *len);
+
+#endif
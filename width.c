@@ -0,0 +1,370 @@
+#define _XOPEN_SOURCE 700
+#include "width.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "util.h"
+
+// Bytes between marks: the most a lookup scans.
+#define WIDTH_STEP 512
+
+// Marks width_edit() works out itself before falling back to a rescan.
+#define WIDTH_EDIT_MARKS 64
+
+// Length of the UTF-8 sequence at p[0..n), with its code point in *cp, or
+// 0 if it is not a valid one.
+static size_t utf8_decode(const unsigned char *p, size_t n, uint32_t *cp) {
+    unsigned char c = p[0];
+    size_t len;
+    uint32_t v, min;
+    if (c >= 0xc2 && c <= 0xdf) {
+        len = 2, v = c & 0x1f, min = 0x80;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        len = 3, v = c & 0x0f, min = 0x800;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        len = 4, v = c & 0x07, min = 0x10000;
+    } else {
+        return 0;
+    }
+    if (n < len) return 0;
+    for (size_t i = 1; i < len; i++) {
+        if ((p[i] & 0xc0) != 0x80) return 0;
+        v = v << 6 | (p[i] & 0x3f);
+    }
+    if (v < min || v > 0x10ffff || (v >= 0xd800 && v <= 0xdfff)) return 0;
+    *cp = v;
+    return len;
+}
+
+size_t width_char(const char *s, size_t n, size_t col, size_t *w, char *out, size_t *nout) {
+    const unsigned char *p = (const unsigned char *)s;
+    unsigned char c = p[0];
+    if (c >= 0x20 && c < 0x7f) {
+        *w = 1;
+        if (out) out[0] = (char)c, *nout = 1;
+        return 1;
+    }
+    if (c == '\t') {
+        *w = WIDTH_TAB - col % WIDTH_TAB;
+        if (out) memset(out, ' ', *w), *nout = *w;
+        return 1;
+    }
+    if (c < 0x80) {
+        *w = 2;
+        if (out) out[0] = '^', out[1] = (char)(c ^ 0x40), *nout = 2;
+        return 1;
+    }
+    uint32_t cp;
+    size_t len = utf8_decode(p, n, &cp);
+    int cw = len ? wcwidth((wchar_t)cp) : -1;
+    if (cw <= 0) {
+        *w = 1;
+        if (out) out[0] = '?', *nout = 1;
+        return len ? len : 1;
+    }
+    *w = (size_t)cw;
+    if (out) memcpy(out, s, len), *nout = len;
+    return len;
+}
+
+size_t width_at(const Line *ln, size_t x, size_t col, size_t *w, char *out, size_t *nout) {
+    size_t k;
+    const char *p = line_peek(ln, x, &k);
+    char tmp[4];
+    if (k < sizeof(tmp) && x + k < ln->len) {
+        // the run ends at the gap; the character may go on after it
+        size_t m = ln->len - x < sizeof(tmp) ? ln->len - x : sizeof(tmp);
+        for (size_t i = 0, r; i < m; i += r) {
+            const char *q = line_peek(ln, x + i, &r);
+            if (r > m - i) r = m - i;
+            memcpy(tmp + i, q, r);
+        }
+        p = tmp;
+        k = m;
+    }
+    return width_char(p, k, col, w, out, nout);
+}
+
+size_t width_prev(const Line *ln, size_t x) {
+    if (!x) return 0;
+    size_t lo = x > 4 ? x - 4 : 0;
+    for (size_t s = x - 1;; s--) {
+        size_t k, w;
+        unsigned char c = *(const unsigned char *)line_peek(ln, s, &k);
+        if ((c & 0xc0) != 0x80) {
+            if (width_at(ln, s, 0, &w, NULL, NULL) == x - s) return s;
+            break;
+        }
+        if (s == lo) break;
+    }
+    return x - 1;
+}
+
+size_t width_fold(const Line *ln, size_t x, size_t wrap, size_t col, size_t w) {
+    if (!wrap || w < 2 || w > wrap || col % wrap + w <= wrap) return col;
+    size_t k;
+    if (*line_peek(ln, x, &k) == '\t') return col;
+    return col + wrap - col % wrap;
+}
+
+// The character at byte x, at column *col or moved on by a fold: leaves
+// *col where it starts and returns its length.
+static size_t width_glyph(const Line *ln, size_t x, size_t wrap, size_t *col, size_t *w,
+                          bool *wide) {
+    size_t n = width_at(ln, x, *col, w, NULL, NULL);
+    if (*w > 1) {
+        size_t k;
+        if (*line_peek(ln, x, &k) != '\t') *wide = true;
+        *col = width_fold(ln, x, wrap, *col, *w);
+    }
+    return n;
+}
+
+// Printable ASCII at byte x, one column a byte: how much of it, up to max.
+static size_t width_ascii(const Line *ln, size_t x, size_t max) {
+    size_t k, i = 0;
+    if (x >= ln->len) return 0;
+    const unsigned char *p = (const unsigned char *)line_peek(ln, x, &k);
+    if (k > max) k = max;
+    while (i < k && p[i] >= 0x20 && p[i] < 0x7f) i++;
+    return i;
+}
+
+size_t width_line(const Line *ln, size_t wrap, bool *wide) {
+    size_t at = 0, col = 0;
+    *wide = false;
+    while (at < ln->len) {
+        size_t i = width_ascii(ln, at, SIZE_MAX);
+        if (i) {
+            at += i;
+            col += i;
+            continue;
+        }
+        size_t w;
+        at += width_glyph(ln, at, wrap, &col, &w, wide);
+        col += w;
+    }
+    return col;
+}
+
+void width_init(WidthMap *M) {
+    memset(M, 0, sizeof(*M));
+    M->y = SIZE_MAX;
+}
+
+void width_free(WidthMap *M) {
+    free(M->mark);
+    width_init(M);
+}
+
+void width_reset(WidthMap *M, size_t y, size_t wrap) {
+    M->y = y;
+    M->wrap = wrap;
+    M->wide = M->whole = false;
+    M->nmark = 0;
+    M->end = M->endcol = 0;
+}
+
+// A character is decoded from up to 4 bytes, so what was found before
+// x - 3 still holds.
+void width_cut(WidthMap *M, size_t x) {
+    size_t keep = x > 3 ? x - 3 : 0;
+    while (M->nmark && M->mark[M->nmark - 1].x > keep) M->nmark--;
+    if (M->end > keep) {
+        M->end = M->nmark ? M->mark[M->nmark - 1].x : 0;
+        M->endcol = M->nmark ? M->mark[M->nmark - 1].col : 0;
+    }
+    M->whole = false;
+}
+
+static void width_reserve(WidthMap *M, size_t n) {
+    if (n <= M->cap) return;
+    while (M->cap < n) M->cap = M->cap ? M->cap * 2 : 16;
+    M->mark = xrealloc(M->mark, M->cap * sizeof(WidthMark));
+}
+
+// The last mark at or before byte x; there is one at 0.
+static size_t width_mark(const WidthMap *M, size_t x) {
+    size_t lo = 0, hi = M->nmark;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (M->mark[mid].x <= x) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static size_t tab_stop(size_t col) {
+    return col - col % WIDTH_TAB + WIDTH_TAB;
+}
+
+// The text after the edit is the old text moved by the same number of
+// bytes, and once the two line up at a mark, by the same number of
+// columns up to the next tab. Past it, both are on a tab stop: the
+// difference is then a whole number of tabs and holds to the end. So
+// only the new bytes, the way to the next old mark and the way from the
+// last mark before the tab to the tab are scanned; the marks after are
+// moved. Wide characters under a fold do not shift evenly, and a line
+// mapped only in part has no end to move, so those are cut and rescanned.
+void width_edit(WidthMap *M, const Line *ln, size_t x, size_t tail) {
+    size_t len = ln->len, old = M->end;
+    bool fits = x <= old && tail <= len - x && tail <= old - x;
+    if (!M->whole || !M->nmark || (M->wrap && M->wide) || !fits) {
+        width_cut(M, x);
+        return;
+    }
+    size_t from = old - tail, to = len - tail; // where the old bytes start, before and after
+
+    // map the new bytes until a character starts on an old mark
+    size_t i0 = width_mark(M, x > 3 ? x - 3 : 0), j = i0 + 1;
+    size_t at = M->mark[i0].x, c = M->mark[i0].col, last = at;
+    WidthMark fresh[WIDTH_EDIT_MARKS];
+    size_t nfresh = 0;
+    bool wide = M->wide;
+    for (;;) {
+        while (j < M->nmark && (M->mark[j].x < from || M->mark[j].x - from + to < at)) j++;
+        if (at >= to && j < M->nmark && M->mark[j].x - from + to == at) break;
+        if (at >= len) break;
+        if (at >= last + WIDTH_STEP) {
+            if (nfresh == WIDTH_EDIT_MARKS) break;
+            fresh[nfresh++] = (WidthMark){ at, c };
+            last = at;
+        }
+        size_t w;
+        at += width_glyph(ln, at, M->wrap, &c, &w, &wide);
+        c += w;
+    }
+    if ((M->wrap && wide) || (at < len && (j == M->nmark || M->mark[j].x - from + to != at))) {
+        width_cut(M, x);
+        return;
+    }
+    M->wide = wide;
+
+    size_t shift = 0, tabshift = 0; // columns the old marks move, before and past the tab
+    size_t t = at;
+    bool tab = false;
+    if (at < len) {
+        shift = c - M->mark[j].col; // modulo SIZE_MAX + 1, as are the sums below
+        for (size_t k; t < len; t += k) {
+            const char *p = line_peek(ln, t, &k);
+            const char *q = memchr(p, '\t', k);
+            if (q) {
+                t += (size_t)(q - p);
+                tab = true;
+                break;
+            }
+        }
+        if (tab) {
+            // the tab's column before the edit, from the last mark before it
+            size_t kt = j;
+            while (kt + 1 < M->nmark && M->mark[kt + 1].x - from + to <= t) kt++;
+            size_t p = M->mark[kt].x - from + to, oc = M->mark[kt].col;
+            while (p < t) {
+                size_t w;
+                p += width_glyph(ln, p, M->wrap, &oc, &w, &wide);
+                oc += w;
+            }
+            tabshift = tab_stop(oc + shift) - tab_stop(oc);
+        }
+        M->endcol += tab ? tabshift : shift;
+    } else {
+        M->endcol = c;
+    }
+
+    // the kept marks, the new ones, then the old ones moved
+    size_t moved = at < len ? M->nmark - j : 0;
+    width_reserve(M, i0 + 1 + nfresh + moved);
+    memmove(M->mark + i0 + 1 + nfresh, M->mark + j, moved * sizeof(WidthMark));
+    memcpy(M->mark + i0 + 1, fresh, nfresh * sizeof(WidthMark));
+    M->nmark = i0 + 1 + nfresh + moved;
+    bool past = false;
+    for (size_t i = i0 + 1 + nfresh; i < M->nmark; i++) {
+        WidthMark *m = &M->mark[i];
+        m->x = m->x - from + to;
+        past = past || (tab && m->x > t);
+        m->col += past ? tabshift : shift;
+    }
+    M->end = len;
+}
+
+// Map on until byte x is passed and, unless col is SIZE_MAX, column col.
+static void width_scan(WidthMap *M, const Line *ln, size_t x, size_t col) {
+    if (M->end > ln->len) width_reset(M, M->y, M->wrap);
+    size_t at = M->end, c = M->endcol;
+    while (at < ln->len && (at < x || (col != SIZE_MAX && c <= col))) {
+        if (!M->nmark || at >= M->mark[M->nmark - 1].x + WIDTH_STEP) {
+            width_reserve(M, M->nmark + 1);
+            M->mark[M->nmark++] = (WidthMark){ at, c };
+        }
+        // printable ASCII, up to where the next mark goes
+        size_t i = width_ascii(ln, at, M->mark[M->nmark - 1].x + WIDTH_STEP - at);
+        if (i) {
+            at += i;
+            c += i;
+            continue;
+        }
+        size_t w;
+        at += width_glyph(ln, at, M->wrap, &c, &w, &M->wide);
+        c += w;
+    }
+    M->end = at;
+    M->endcol = c;
+    M->whole = at == ln->len;
+}
+
+size_t width_col(WidthMap *M, const Line *ln, size_t x) {
+    if (x > ln->len) x = ln->len;
+    width_scan(M, ln, x, SIZE_MAX);
+    if (x == ln->len && M->end == x) return M->endcol;
+    if (!M->nmark) return 0;
+    size_t k = width_mark(M, x);
+    size_t at = M->mark[k].x, c = M->mark[k].col;
+    bool wide;
+    while (at < ln->len) {
+        size_t i = width_ascii(ln, at, x - at);
+        if (i) {
+            at += i;
+            c += i;
+            continue;
+        }
+        size_t w, n = width_glyph(ln, at, M->wrap, &c, &w, &wide);
+        if (at + n > x) break; // x is this character, or inside it
+        at += n;
+        c += w;
+    }
+    return c;
+}
+
+size_t width_byte(WidthMap *M, const Line *ln, size_t col, size_t *start) {
+    width_scan(M, ln, 0, col);
+    size_t at = 0, c = 0;
+    if (M->nmark) {
+        // the last mark at or before col
+        size_t lo = 0, hi = M->nmark;
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (M->mark[mid].col <= col) lo = mid;
+            else hi = mid;
+        }
+        at = M->mark[lo].x;
+        c = M->mark[lo].col;
+    }
+    bool wide;
+    while (at < ln->len) {
+        size_t i = width_ascii(ln, at, col - c);
+        if (i) {
+            at += i;
+            c += i;
+            continue;
+        }
+        size_t w, n = width_glyph(ln, at, M->wrap, &c, &w, &wide);
+        if (c + w > col) break;
+        at += n;
+        c += w;
+    }
+    *start = c;
+    return at;
+}
@@ -0,0 +1,75 @@
+#ifndef WIDTH_H
+#define WIDTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "line.h"
+
+// How text looks on screen. It is read as UTF-8: a character takes the
+// columns wcwidth() gives it, tabs run to the next multiple of WIDTH_TAB,
+// control bytes show as ^X, and bytes that do not decode (or characters
+// that do not print) show as '?'.
+#define WIDTH_TAB 8
+
+// Longest glyph width_char() makes: a whole tab of spaces.
+#define WIDTH_GLYPH_MAX WIDTH_TAB
+
+// The character at p[0..n), n >= 1, drawn at column col. Returns its length
+// in bytes and sets *w to its width. With out set, the bytes that draw it
+// go there and their number to *nout.
+size_t width_char(const char *p, size_t n, size_t col, size_t *w, char *out, size_t *nout);
+
+// The same for the character at byte x of ln, which may straddle its gap.
+size_t width_at(const Line *ln, size_t x, size_t col, size_t *w, char *out, size_t *nout);
+
+// Where the character before byte x of ln starts.
+size_t width_prev(const Line *ln, size_t x);
+
+// Soft wrap folds lines every wrap columns (0 for none). A character
+// wider than one column, other than a tab, that would cross a fold starts
+// the next row instead, leaving the columns before it blank. Where the
+// character at byte x of ln, w columns wide at column col, starts.
+size_t width_fold(const Line *ln, size_t x, size_t wrap, size_t col, size_t w);
+
+// Display columns of the whole of ln folded every wrap columns, with in
+// *wide whether it has a character a fold can move.
+size_t width_line(const Line *ln, size_t wrap, bool *wide);
+
+// Display columns of one line, found by scanning from its start only as
+// far as a lookup needs. Marks are kept at character boundaries about
+// WIDTH_STEP bytes apart, so a lookup scans at most that far past the
+// mark it finds by binary search, however long the line.
+typedef struct {
+    size_t x, col;
+} WidthMark;
+
+typedef struct {
+    size_t y;           // the line mapped, or SIZE_MAX when free
+    size_t wrap;        // folded every wrap columns, or 0
+    bool wide;          // a character a fold can move was seen
+    bool whole;         // mapped to the end of the line
+    unsigned long used; // last lookup, for picking one to reuse
+    WidthMark *mark;
+    size_t nmark, cap;
+    size_t end, endcol; // scanned up to this character boundary
+} WidthMap;
+
+void   width_init(WidthMap *M);
+void   width_free(WidthMap *M);
+void   width_reset(WidthMap *M, size_t y, size_t wrap);
+// The line changed from byte x on: keep only what comes before it.
+void   width_cut(WidthMap *M, size_t x);
+// The same, where the last tail bytes of the line were there before the
+// change: a map of the whole line stays whole, at the cost of scanning
+// the new bytes and about WIDTH_STEP more.
+void   width_edit(WidthMap *M, const Line *ln, size_t x, size_t tail);
+
+// The column where the character at byte x starts.
+size_t width_col(WidthMap *M, const Line *ln, size_t x);
+// The character covering column col: its byte offset, and in *start the
+// column it starts at. In the blank before a character moved by a fold,
+// that character. Past the end of the line, the end.
+size_t width_byte(WidthMap *M, const Line *ln, size_t col, size_t *start);
+
+#endif
@@ -0,0 +1,380 @@
+#include "wrap.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "width.h"
+
+#define WRAP_MAX 64
+
+struct WrapNode {
+    bool leaf;
+    int  n;
+    union {
+        struct {
+            size_t width[WRAP_MAX];
+            bool   wide[WRAP_MAX]; // the line has a character a fold can move
+        } lf;
+        struct {
+            WrapNode *kid[WRAP_MAX];
+            size_t    lines[WRAP_MAX];
+            size_t    rows[WRAP_MAX];
+            size_t    width[WRAP_MAX]; // the widest line under the kid
+            bool      wide[WRAP_MAX];  // some line under the kid is wide
+        } in;
+    } u;
+};
+
+// A leaf is allocated with room for its own fields only.
+static WrapNode *node_new(bool leaf) {
+    size_t size = sizeof(WrapNode);
+    if (leaf) size = offsetof(WrapNode, u) + sizeof(((WrapNode *)0)->u.lf);
+    WrapNode *nd = xmalloc(size);
+    nd->leaf = leaf;
+    nd->n = 0;
+    return nd;
+}
+
+static void node_free(WrapNode *nd) {
+    if (!nd->leaf) {
+        for (int i = 0; i < nd->n; i++) node_free(nd->u.in.kid[i]);
+    }
+    free(nd);
+}
+
+static size_t rows_of(size_t width, size_t cols) {
+    return width / cols + 1;
+}
+
+static void node_stats(const WrapNode *nd, size_t cols, size_t *lines, size_t *rows, size_t *width,
+                       bool *wide) {
+    size_t l = 0, r = 0, w = 0;
+    bool any = false;
+    if (nd->leaf) {
+        l = (size_t)nd->n;
+        for (int i = 0; i < nd->n; i++) {
+            r += rows_of(nd->u.lf.width[i], cols);
+            if (nd->u.lf.width[i] > w) w = nd->u.lf.width[i];
+            any |= nd->u.lf.wide[i];
+        }
+    } else {
+        for (int i = 0; i < nd->n; i++) {
+            l += nd->u.in.lines[i];
+            r += nd->u.in.rows[i];
+            if (nd->u.in.width[i] > w) w = nd->u.in.width[i];
+            any |= nd->u.in.wide[i];
+        }
+    }
+    *lines = l;
+    *rows = r;
+    *width = w;
+    *wide = any;
+}
+
+static void node_restat(WrapNode *nd, int k, size_t cols) {
+    node_stats(nd->u.in.kid[k], cols, &nd->u.in.lines[k], &nd->u.in.rows[k], &nd->u.in.width[k],
+               &nd->u.in.wide[k]);
+}
+
+// Copy count items from src[spos..] over dst[dpos..].
+static void node_move(WrapNode *dst, int dpos, const WrapNode *src, int spos, int count) {
+    if (count <= 0) return;
+    size_t n = (size_t)count;
+    if (dst->leaf) {
+        memmove(dst->u.lf.width + dpos, src->u.lf.width + spos, n * sizeof(size_t));
+        memmove(dst->u.lf.wide + dpos, src->u.lf.wide + spos, n * sizeof(bool));
+        return;
+    }
+    memmove(dst->u.in.kid + dpos, src->u.in.kid + spos, n * sizeof(WrapNode *));
+    memmove(dst->u.in.lines + dpos, src->u.in.lines + spos, n * sizeof(size_t));
+    memmove(dst->u.in.rows + dpos, src->u.in.rows + spos, n * sizeof(size_t));
+    memmove(dst->u.in.width + dpos, src->u.in.width + spos, n * sizeof(size_t));
+    memmove(dst->u.in.wide + dpos, src->u.in.wide + spos, n * sizeof(bool));
+}
+
+// Move the upper half of a full node to a new right sibling.
+static WrapNode *node_split(WrapNode *nd) {
+    WrapNode *right = node_new(nd->leaf);
+    int half = nd->n / 2;
+    node_move(right, 0, nd, half, nd->n - half);
+    right->n = nd->n - half;
+    nd->n = half;
+    return right;
+}
+
+// The child holding line *at, which becomes a line number within it.
+static int node_find(const WrapNode *nd, size_t *at) {
+    int k = 0;
+    while (k + 1 < nd->n && *at >= nd->u.in.lines[k]) *at -= nd->u.in.lines[k++];
+    return k;
+}
+
+// Put kid in slot k of nd. Returns the new right sibling if nd split.
+static WrapNode *node_add_kid(WrapNode *nd, int k, WrapNode *kid, size_t cols) {
+    WrapNode *sib = NULL, *t = nd;
+    if (nd->n == WRAP_MAX) {
+        sib = node_split(nd);
+        if (k > nd->n) {
+            k -= nd->n;
+            t = sib;
+        }
+    }
+    node_move(t, k + 1, t, k, t->n - k);
+    t->u.in.kid[k] = kid;
+    t->n++;
+    node_restat(t, k, cols);
+    return sib;
+}
+
+static WrapNode *node_insert(WrapNode *nd, size_t at, size_t width, bool wide, size_t cols) {
+    if (nd->leaf) {
+        WrapNode *sib = NULL, *t = nd;
+        if (nd->n == WRAP_MAX) {
+            sib = node_split(nd);
+            if (at > (size_t)nd->n) {
+                at -= (size_t)nd->n;
+                t = sib;
+            }
+        }
+        node_move(t, (int)at + 1, t, (int)at, t->n - (int)at);
+        t->u.lf.width[at] = width;
+        t->u.lf.wide[at] = wide;
+        t->n++;
+        return sib;
+    }
+
+    int k = 0;
+    while (k + 1 < nd->n && at > nd->u.in.lines[k]) at -= nd->u.in.lines[k++];
+    WrapNode *sib = node_insert(nd->u.in.kid[k], at, width, wide, cols);
+    if (!sib) {
+        nd->u.in.lines[k]++;
+        nd->u.in.rows[k] += rows_of(width, cols);
+        if (width > nd->u.in.width[k]) nd->u.in.width[k] = width;
+        nd->u.in.wide[k] |= wide;
+        return NULL;
+    }
+    node_restat(nd, k, cols);
+    return node_add_kid(nd, k + 1, sib, cols);
+}
+
+// Remove lines [at, at + n) of nd, dropping whole subtrees where they are
+// covered. Nodes are not merged back up to size: the height only grows
+// with the lines inserted, so it stays logarithmic.
+static void node_remove(WrapNode *nd, size_t at, size_t n, size_t cols) {
+    if (nd->leaf) {
+        node_move(nd, (int)at, nd, (int)(at + n), nd->n - (int)(at + n));
+        nd->n -= (int)n;
+        return;
+    }
+    int out = 0;
+    size_t base = 0;
+    for (int i = 0; i < nd->n; i++) {
+        size_t cnt = nd->u.in.lines[i];
+        if (at < base + cnt && at + n > base) {
+            size_t lo = at > base ? at - base : 0;
+            size_t hi = at + n < base + cnt ? at + n - base : cnt;
+            base += cnt;
+            if (lo == 0 && hi == cnt) {
+                node_free(nd->u.in.kid[i]);
+                continue;
+            }
+            node_remove(nd->u.in.kid[i], lo, hi - lo, cols);
+            node_restat(nd, i, cols);
+        } else {
+            base += cnt;
+        }
+        node_move(nd, out++, nd, i, 1);
+    }
+    nd->n = out;
+}
+
+static void node_set(WrapNode *nd, size_t at, size_t width, bool wide, size_t cols) {
+    if (nd->leaf) {
+        nd->u.lf.width[at] = width;
+        nd->u.lf.wide[at] = wide;
+        return;
+    }
+    int k = node_find(nd, &at);
+    node_set(nd->u.in.kid[k], at, width, wide, cols);
+    node_restat(nd, k, cols);
+}
+
+// Lines narrower than lo take one row at either width. Wide lines at
+// least that wide, the first of them line y, are measured again: where
+// the folds fall moves their characters.
+static void node_resize(WrapNode *nd, Buffer *B, size_t y, size_t lo, size_t cols) {
+    if (nd->leaf) {
+        for (int i = 0; i < nd->n; i++) {
+            if (!nd->u.lf.wide[i] || nd->u.lf.width[i] < lo) continue;
+            const Line *ln = buffer_line(B, y + (size_t)i);
+            nd->u.lf.width[i] = width_line(ln, cols, &nd->u.lf.wide[i]);
+        }
+        return;
+    }
+    for (int i = 0; i < nd->n; i++) {
+        if (nd->u.in.width[i] >= lo) {
+            WrapNode *kid = nd->u.in.kid[i];
+            if (!kid->leaf || nd->u.in.wide[i]) node_resize(kid, B, y, lo, cols);
+            node_restat(nd, i, cols);
+        }
+        y += nd->u.in.lines[i];
+    }
+}
+
+static void wrap_total(WrapTree *W) {
+    size_t width;
+    bool wide;
+    node_stats(W->root, W->cols, &W->nlines, &W->rows, &width, &wide);
+}
+
+void wrap_init(WrapTree *W) {
+    W->root = node_new(true);
+    W->cols = 1;
+    W->nlines = W->rows = 0;
+}
+
+void wrap_free(WrapTree *W) {
+    if (W->root) node_free(W->root);
+    W->root = NULL;
+    W->nlines = W->rows = 0;
+}
+
+static void level_add(WrapNode ***level, size_t *n, size_t *cap, WrapNode *nd) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *level = xrealloc(*level, *cap * sizeof(**level));
+    }
+    (*level)[(*n)++] = nd;
+}
+
+// Full leaves in document order, then a level of parents at a time.
+void wrap_build(WrapTree *W, Buffer *B, size_t cols) {
+    wrap_free(W);
+    W->cols = cols ? cols : 1;
+
+    WrapNode **level = NULL, *nd = NULL;
+    size_t n = 0, cap = 0;
+    size_t nlines = buffer_nlines(B);
+    LtIter it;
+    buffer_iter(B, 0, &it);
+    for (size_t y = 0; y < nlines; y++) {
+        const Line *ln = buffer_iter_next(&it);
+        if (!nd || nd->n == WRAP_MAX) level_add(&level, &n, &cap, nd = node_new(true));
+        nd->u.lf.width[nd->n] = width_line(ln, W->cols, &nd->u.lf.wide[nd->n]);
+        nd->n++;
+    }
+    if (!n) level_add(&level, &n, &cap, node_new(true));
+
+    while (n > 1) {
+        size_t m = 0;
+        for (size_t i = 0; i < n; i += WRAP_MAX) {
+            WrapNode *p = node_new(false);
+            for (size_t j = i; j < n && j < i + WRAP_MAX; j++) {
+                p->u.in.kid[p->n] = level[j];
+                node_restat(p, p->n, W->cols);
+                p->n++;
+            }
+            level[m++] = p;
+        }
+        n = m;
+    }
+    W->root = level[0];
+    free(level);
+    wrap_total(W);
+}
+
+void wrap_resize(WrapTree *W, Buffer *B, size_t cols) {
+    if (!cols) cols = 1;
+    if (cols == W->cols) return;
+    size_t lo = cols < W->cols ? cols : W->cols;
+    W->cols = cols;
+    node_resize(W->root, B, 0, lo, cols);
+    wrap_total(W);
+}
+
+void wrap_set(WrapTree *W, size_t y, size_t width, bool wide) {
+    if (y >= W->nlines) return;
+    node_set(W->root, y, width, wide, W->cols);
+    wrap_total(W);
+}
+
+void wrap_insert(WrapTree *W, size_t y, size_t width, bool wide) {
+    if (y > W->nlines) y = W->nlines;
+    WrapNode *sib = node_insert(W->root, y, width, wide, W->cols);
+    if (sib) {
+        WrapNode *root = node_new(false);
+        root->n = 2;
+        root->u.in.kid[0] = W->root;
+        root->u.in.kid[1] = sib;
+        node_restat(root, 0, W->cols);
+        node_restat(root, 1, W->cols);
+        W->root = root;
+    }
+    wrap_total(W);
+}
+
+void wrap_remove(WrapTree *W, size_t y, size_t n) {
+    if (y >= W->nlines) return;
+    if (n > W->nlines - y) n = W->nlines - y;
+    if (!n) return;
+    node_remove(W->root, y, n, W->cols);
+    if (!W->root->leaf && W->root->n == 0) {
+        free(W->root);
+        W->root = node_new(true);
+    }
+    while (!W->root->leaf && W->root->n == 1) {
+        WrapNode *old = W->root;
+        W->root = old->u.in.kid[0];
+        free(old);
+    }
+    wrap_total(W);
+}
+
+size_t wrap_rows(const WrapTree *W, size_t y) {
+    if (y >= W->nlines) return 1;
+    const WrapNode *nd = W->root;
+    while (!nd->leaf) nd = nd->u.in.kid[node_find(nd, &y)];
+    return rows_of(nd->u.lf.width[y], W->cols);
+}
+
+size_t wrap_row(const WrapTree *W, size_t y) {
+    if (y >= W->nlines) return W->rows;
+    const WrapNode *nd = W->root;
+    size_t r = 0;
+    while (!nd->leaf) {
+        int k = node_find(nd, &y);
+        for (int i = 0; i < k; i++) r += nd->u.in.rows[i];
+        nd = nd->u.in.kid[k];
+    }
+    for (size_t i = 0; i < y; i++) r += rows_of(nd->u.lf.width[i], W->cols);
+    return r;
+}
+
+size_t wrap_line(const WrapTree *W, size_t r, size_t *sub) {
+    if (!W->nlines) {
+        *sub = 0;
+        return 0;
+    }
+    if (r >= W->rows) {
+        size_t y = W->nlines - 1;
+        *sub = wrap_rows(W, y) - 1;
+        return y;
+    }
+    const WrapNode *nd = W->root;
+    size_t y = 0;
+    while (!nd->leaf) {
+        int k = 0;
+        while (k + 1 < nd->n && r >= nd->u.in.rows[k]) {
+            r -= nd->u.in.rows[k];
+            y += nd->u.in.lines[k++];
+        }
+        nd = nd->u.in.kid[k];
+    }
+    int i = 0;
+    for (size_t n; i + 1 < nd->n && r >= (n = rows_of(nd->u.lf.width[i], W->cols)); i++) r -= n;
+    *sub = r;
+    return y + (size_t)i;
+}
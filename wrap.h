@@ -0,0 +1,55 @@
+#ifndef WRAP_H
+#define WRAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buffer.h"
+
+typedef struct WrapNode WrapNode;
+
+// Soft wrap: long lines fold at the screen width instead of running off
+// its right edge. A line w columns wide takes w / cols + 1 screen rows,
+// one more than it fills when it ends exactly at the edge so the cursor
+// has somewhere to go after it. Widths count the blanks left where a
+// fold moves a wide character to the next row (see width_fold()).
+//
+// The width of every line is kept in a B+tree whose internal nodes cache,
+// for each child, its lines, its rows and its widest line. A screen row
+// is found from a line, or a line from a screen row, in one descent; an
+// edit re-measures only the lines it touched; and a new screen width only
+// visits the subtrees holding a line at least as wide as the narrower of
+// the two widths, since every other line takes one row either way; of
+// those, only lines with a wide character are measured again.
+typedef struct {
+    WrapNode *root;
+    size_t cols;   // wrap width
+    size_t nlines;
+    size_t rows;   // of all lines
+} WrapTree;
+
+void   wrap_init(WrapTree *W);
+void   wrap_free(WrapTree *W);
+
+// Measure every line of B, wrapping at cols.
+void   wrap_build(WrapTree *W, Buffer *B, size_t cols);
+// Wrap at cols instead, measuring again from B what that moves.
+void   wrap_resize(WrapTree *W, Buffer *B, size_t cols);
+
+// Line y is now width columns wide, and wide if it has a character a fold
+// can move (see width_line()).
+void   wrap_set(WrapTree *W, size_t y, size_t width, bool wide);
+// Such a line was inserted before line y.
+void   wrap_insert(WrapTree *W, size_t y, size_t width, bool wide);
+// Lines [y, y + n) were deleted.
+void   wrap_remove(WrapTree *W, size_t y, size_t n);
+
+// Rows of line y.
+size_t wrap_rows(const WrapTree *W, size_t y);
+// The first row of line y; past the last line, the number of rows.
+size_t wrap_row(const WrapTree *W, size_t y);
+// The line holding row r, and in *sub which of its rows r is. Past the
+// last row, the last row of the last line.
+size_t wrap_line(const WrapTree *W, size_t r, size_t *sub);
+
+#endif